@@ -0,0 +1,159 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Single-dummy play at the command-line: declarer's and dummy's hands are shown, the user enters
+//  every card played (the defenders' too), and each time declarer or dummy is to play the cards they
+//  could play are rated over random deals of the defenders' hands
+//
+
+#include "advisor.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+namespace {
+
+	inline char suittext(suit_t suit) { return "CDHSN"[suit]; }
+	inline char suittext(card_t c) { return suittext(suit(c)); }
+	inline char ranktext(card_t c) { return "23456789TJQKA"[rank(c)]; }
+	inline char playertext(player_t pl) { return "NESW"[pl]; }
+
+	inline card_t card(const std::string& str) {
+		if (str.size() != 2) return -1;
+		size_t s = std::string("CDHS").find(toupper(str[0]));
+		size_t r = std::string("23456789TJQKA").find(toupper(str[1]));
+		if (s == std::string::npos || r == std::string::npos) return -1;
+		return card(suit_t(s), rank_t(r));
+	}
+
+	// Reads the user's input on its own thread, so that the sampling can carry on while they think
+	struct input_t
+	{
+		std::mutex mutex;
+		std::deque<std::string> lines;
+		bool closed;
+
+		input_t() : closed(false) { }
+
+		void run()
+		{
+			std::string str;
+			while (std::cin >> str) {
+				std::lock_guard<std::mutex> lock(mutex);
+				lines.push_back(str);
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+
+		// Returns false if there's nothing yet; sets eof once there never will be
+		bool get(std::string& str, bool& eof)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			eof = closed && lines.empty();
+			if (lines.empty()) return false;
+			str = lines.front();
+			lines.pop_front();
+			return true;
+		}
+	};
+
+	// The cards the player has left
+	void print_hand(const deal_t& d, const play_t& play, player_t pl)
+	{
+		bool played[52] = { false };
+		for (int i = 0; i < play.nCardsPlayed; ++i) played[play.played[i]] = true;
+		std::cout << playertext(pl) << ": ";
+		for (int s = sx; s >= cx; --s) {
+			std::cout << suittext(suit_t(s)) << ' ';
+			for (card_t c = card(suit_t(s), 12); c >= 0; c -= 4)
+				if (d.holder[c] == pl && !played[c]) std::cout << ranktext(c);
+			std::cout << "  ";
+		}
+		std::cout << std::endl;
+	}
+
+	// The plays available, best first
+	void print_advice(const advice_t& advice)
+	{
+		std::vector<card_t> cards;
+		for (card_t c = 0; c < 52; ++c)
+			if (advice.count[c]) cards.push_back(c);
+		std::stable_sort(cards.begin(), cards.end(), [&](card_t a, card_t b) { return advice.tricks[a] > advice.tricks[b]; });
+		std::cout << advice.samples << " deals:";
+		for (size_t i = 0; i < cards.size(); ++i)
+			std::cout << "  " << suittext(cards[i]) << ranktext(cards[i]) << ' ' << std::fixed << std::setprecision(2) << advice.tricks[cards[i]];
+		std::cout << std::endl;
+	}
+}
+
+// Single-dummy play, with advice for declarer
+void single_dummy(const deal_t& d, const deal_constraints_t& constraints, unsigned long long seed, int threads)
+{
+	play_t play;
+	play.nCardsPlayed = 0;
+	input_t input;
+	std::thread(&input_t::run, &input).detach();
+	std::cout << "Enter each card played (e.g. SA), or u to undo. For declarer and dummy, the cards they can play" << std::endl;
+	std::cout << "are shown with the tricks they take from here on (including this one), on average over deals" << std::endl;
+	std::cout << "of the defenders' hands that fit what they've played." << std::endl;
+
+	while (play.nCardsPlayed < 52) {
+		const player_t pl = next_to_play(&d, &play);
+		std::cout << std::endl << "Trick " << (play.nCardsPlayed / 4 + 1) << ":";
+		for (int i = play.nCardsPlayed - play.nCardsPlayed % 4; i < play.nCardsPlayed; ++i)
+			std::cout << ' ' << suittext(play.played[i]) << ranktext(play.played[i]);
+		std::cout << std::endl;
+		print_hand(d, play, partner(d.declarer));
+		print_hand(d, play, d.declarer);
+
+		// Rate declarer's plays until the user makes one
+		advisor_t* advisor = (partnership(pl) == partnership(d.declarer)) ? start_advice(&d, &play, &constraints, seed, threads) : 0;
+		if (partnership(pl) == partnership(d.declarer) && !advisor) std::cout << "The defenders' hands can't be dealt" << std::endl;
+		std::cout << "Play for " << playertext(pl) << ": " << std::flush;
+		unsigned long shown = 4;
+		std::string str;
+		bool eof = false;
+		while (!input.get(str, eof) && !eof) {
+			if (!advisor) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				continue;
+			}
+			const int waited = wait_advice(advisor, shown, 50);
+			if (waited < 0) {
+				// No more samples will come
+				free_advice(advisor);
+				advisor = 0;
+				std::cout << std::endl << "The defenders' hands can't be dealt" << std::endl;
+				std::cout << "Play for " << playertext(pl) << ": " << std::flush;
+			} else if (waited) {
+				advice_t advice;
+				poll_advice(advisor, &advice);
+				std::cout << std::endl;
+				print_advice(advice);
+				std::cout << "Play for " << playertext(pl) << ": " << std::flush;
+				shown = 2 * advice.samples;
+			}
+		}
+		if (advisor) free_advice(advisor);
+		if (eof) break;
+
+		if (str == "u") {
+			if (play.nCardsPlayed > 0) play.nCardsPlayed--;
+			continue;
+		}
+		const card_t c = card(str);
+		if (c < 0 || !could_play(&d, &play, c)) {
+			std::cout << "That can't be played" << std::endl;
+			continue;
+		}
+		play.played[play.nCardsPlayed++] = c;
+	}
+}
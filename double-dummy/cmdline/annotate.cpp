@@ -0,0 +1,127 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Annotation of played hands: for each card, the double-dummy result before and after it, and what
+//  it cost. The input has a hand per line, the deal as written by serialise_deal followed by the play
+//  as written by serialise_play. The hands are annotated on a pool of threads and printed in order.
+//
+
+#include "analyzer.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cctype>
+
+// Reading deals, from the records mode
+bool parse_deal(const std::string& text, deal_t& deal);
+
+namespace {
+
+	// A played hand
+	struct annotated_t {
+		bool valid;
+		deal_t deal;
+		play_t play;
+		int annotated;				// how many of the cards were legal
+		play_annotation_t notes[52];
+	};
+
+	inline char playertext(player_t pl) { return "NESW"[pl]; }
+	inline char suittext(suit_t s) { return "CDHSN"[s]; }
+	inline char ranktext(rank_t r) { return "23456789TJQKA"[r]; }
+
+	// "<deal>:<declarer><trumps> <play>"; returns false if it can't be read
+	bool parse(const std::string& line, annotated_t& a)
+	{
+		std::string::size_type colon = line.find(':');
+		if (colon == std::string::npos || line.size() < colon + 3) return false;
+		const std::string::size_type declarer = std::string("NESW").find(toupper(line[colon+1]));
+		const std::string::size_type trumps = std::string("CDHSN").find(toupper(line[colon+2]));
+		if (declarer == std::string::npos || trumps == std::string::npos) return false;
+		if (!parse_deal("N:" + line.substr(0, colon), a.deal)) return false;
+		a.deal.declarer = player_t(declarer);
+		a.deal.trumps = suit_t(trumps);
+
+		std::string play;
+		for (std::string::size_type i = colon + 3; i < line.size(); ++i)
+			if (!isspace(line[i])) play += line[i];
+		if (play.size() % 2 || play.size() > 2*52) return false;
+		for (std::string::size_type i = 0; i < play.size(); i += 2)
+			if (std::string("CDHS").find(toupper(play[i])) == std::string::npos || std::string("23456789TJQKA").find(toupper(play[i+1])) == std::string::npos)
+				return false;
+		deserialise_play(&a.play, play.c_str());
+		return true;
+	}
+
+	// Run on each thread of the pool, taking the next hand until there are none left
+	void annotate_all(std::vector<annotated_t>& hands, std::atomic<size_t>& next)
+	{
+		for (size_t i = next++; i < hands.size(); i = next++) {
+			annotated_t& a = hands[i];
+			if (!a.valid) continue;
+			cache_t* cache = new_cache();
+			a.annotated = annotate_play(&a.deal, &a.play, cache, a.notes);
+			free_cache(cache);
+		}
+	}
+
+	void print(const annotated_t& a)
+	{
+		for (int i = 0; i < a.annotated; ++i) {
+			const card_t c = a.play.played[i];
+			std::cout << "  " << (i/4 + 1) << '.' << (i%4 + 1) << ' ' << playertext(a.deal.holder[c]) << ' ';
+			std::cout << suittext(suit(c)) << ranktext(rank(c)) << "  " << a.notes[i].before << " -> " << a.notes[i].after;
+			if (a.notes[i].cost > 0) std::cout << "  costs " << a.notes[i].cost;
+			std::cout << std::endl;
+		}
+		if (a.annotated < a.play.nCardsPlayed) std::cout << "  card " << (a.annotated + 1) << " can't be played" << std::endl;
+	}
+}
+
+// Annotate every played hand in a file ("-" for standard input)
+void annotate(const std::string& filename, int threads)
+{
+	std::ifstream file;
+	if (filename != "-") {
+		file.open(filename.c_str());
+		if (!file) {
+			std::cerr << "Can't open " << filename << std::endl;
+			return;
+		}
+	}
+	std::istream& in = (filename == "-") ? std::cin : file;
+
+	std::vector<annotated_t> hands;
+	std::vector<int> lines;
+	std::string line;
+	int lineno = 0;
+	while (std::getline(in, line)) {
+		lineno++;
+		if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+		annotated_t a;
+		a.valid = parse(line, a);
+		a.annotated = 0;
+		hands.push_back(a);
+		lines.push_back(lineno);
+	}
+
+	std::vector<std::thread> pool;
+	std::atomic<size_t> next(0);
+	for (int i = 0; i < threads; ++i)
+		pool.push_back(std::thread(annotate_all, std::ref(hands), std::ref(next)));
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+
+	for (size_t i = 0; i < hands.size(); ++i) {
+		if (!hands[i].valid) {
+			std::cerr << "Line " << lines[i] << ": can't read the hand" << std::endl;
+			continue;
+		}
+		std::cout << "Line " << lines[i] << " (" << playertext(hands[i].deal.declarer) << ' ' << suittext(hands[i].deal.trumps) << ")" << std::endl;
+		print(hands[i]);
+	}
+}
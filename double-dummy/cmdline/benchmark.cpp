@@ -0,0 +1,156 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+#include "analyzer.h"
+#include "par.h"
+#include "dealer.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+	// The number of single-target searches needed to pin down a result of 0-13 tricks, when probing
+	// outwards from a guess (as the table solver does) or by plain bisection (as analyze() used to)
+	struct count_probe_t {
+		int actual;
+		int n;
+	};
+	int probe_actual(int goal, void* context)
+	{
+		count_probe_t& p = *(count_probe_t*)context;
+		++p.n;
+		return p.actual >= goal;
+	}
+	int probes_from(int guess, int actual)
+	{
+		bound_t window;
+		window.low = 0;
+		window.high = 1 + 13;
+		count_probe_t probe = { actual, 0 };
+		probe_tricks(&window, guess, probe_actual, &probe);
+		return probe.n;
+	}
+	int probes_bisection(int actual)
+	{
+		int low = 0, high = 1 + 13, n = 0;
+		while (low+1 < high) {
+			const int goal = (low + high) / 2;
+			if (actual >= goal) low = goal; else high = goal;
+			++n;
+		}
+		return n;
+	}
+
+	// Solve the table for a deal with the given cache policy, returning the time taken and
+	// adding up the number of results cached
+	double solve_table(deal_t deal, const cache_config_t& config, unsigned long& entries)
+	{
+		play_t play;
+		play.nCardsPlayed = 0;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int s = 0; s <= 4; ++s) {
+			cache_t* cache = new_cache();
+			configure_cache(cache, &config);
+			deal.trumps = suit_t(s);
+			for (int pl = 0; pl < 4; ++pl) {
+				deal.declarer = player_t(pl);
+				position_analysis_t pos;
+				pos.global.low = 0;
+				pos.global.high = 1 + 13;
+				for (int i = 0; i < 52; ++i)
+					pos.play[i] = pos.global;
+				analyze(&deal, &play, cache, 0, &pos, best_only);
+			}
+			entries += cache_entries(cache);
+			free_cache(cache);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+// Measure the static trick estimate against the real double-dummy results on random deals
+void benchmark(int deals)
+{
+	deal_t deal;
+	play_t play;
+	play.nCardsPlayed = 0;
+	int errors[1 + 2*13] = {0};			// [estimate - actual + 13]
+	int cells = 0, searches = 0, bisection = 0, estimated = 0;
+	double estimateTime = 0;
+
+	deal_constraints_t constraints;
+	no_constraints(&constraints);
+	dealer_t* dealer = new_dealer(&constraints, 1, 0);
+	for (int i = 0; i < deals; ++i) {
+		next_deal(dealer, &deal);
+		deal_analysis_t analysis;
+		int n;
+		analyze_deal(&deal, &analysis, &n);
+		searches += n;
+		for (int s = 0; s <= 4; ++s) {
+			deal.trumps = suit_t(s);
+			for (int pl = 0; pl < 4; ++pl) {
+				deal.declarer = player_t(pl);
+				const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				const int estimate = estimate_tricks(&deal, &play, partnership(deal.declarer));
+				estimateTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				const int actual = analysis.tricks[pl][s];
+				errors[estimate - actual + 13]++;
+				bisection += probes_bisection(actual);
+				estimated += probes_from(estimate, actual);
+				cells++;
+			}
+		}
+		std::cout << "." << std::flush;
+	}
+	std::cout << std::endl;
+	free_dealer(dealer);
+	if (cells == 0) return;
+
+	// Report
+	std::cout << "Estimate - actual:" << std::endl;
+	for (int e = -13; e <= 13; ++e) {
+		if (errors[e + 13] == 0) continue;
+		std::cout << std::setw(4) << e << " " << std::setw(5) << std::fixed << std::setprecision(1)
+			<< 100.0 * errors[e + 13] / cells << "%" << std::endl;
+	}
+	std::cout << "Time per estimate: " << std::setprecision(2) << 1e6 * estimateTime / cells << "us" << std::endl;
+	std::cout << "Searches per cell: " << double(bisection) / cells << " bisecting, "
+		<< double(estimated) / cells << " from the estimate, "
+		<< double(searches) / cells << " in the table solver" << std::endl;
+}
+
+// Compare cache policies on random deals
+void cache_benchmark(int deals)
+{
+	std::vector<deal_t> corpus(deals);
+	deal_constraints_t constraints;
+	no_constraints(&constraints);
+	dealer_t* dealer = new_dealer(&constraints, 1, 0);
+	for (int i = 0; i < deals; ++i)
+		next_deal(dealer, &corpus[i]);
+	free_dealer(dealer);
+
+	const int tricks[] = { 0, 2, 3, 4, 5 };
+	const unsigned long nodes[] = { 100, 1000, 10000 };
+	std::cout << "Tricks Nodes   Time  Entries" << std::endl;
+	for (int t = 0; t < 5; ++t) {
+		for (int n = 0; n < 3; ++n) {
+			if (tricks[t] == 0 && n > 0) continue;
+			cache_config_t config;
+			default_cache_config(&config);
+			config.shallow_tricks = tricks[t];
+			config.shallow_nodes = nodes[n];
+			double time = 0;
+			unsigned long entries = 0;
+			for (int i = 0; i < deals; ++i)
+				time += solve_table(corpus[i], config, entries);
+			std::cout << std::setw(6) << tricks[t] << std::setw(6) << (tricks[t] ? nodes[n] : 0)
+				<< std::setw(7) << std::fixed << std::setprecision(1) << time
+				<< std::setw(9) << entries / deals << std::endl;
+		}
+	}
+}
@@ -0,0 +1,197 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Choosing a contract by simulation: one partnership's hands are known, the others are dealt at random
+//  (within any constraints), and the double-dummy table of each deal gives the chance of making every
+//  contract and its expected score
+//
+
+#include "par.h"
+#include "dealer.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cmath>
+
+namespace {
+
+	inline char suittext(suit_t suit) { return "CDHSN"[suit]; }
+	inline char playertext(player_t pl) { return "NESW"[pl]; }
+
+	// A contract for our side
+	struct contract_t {
+		int level;
+		suit_t trumps;
+		player_t declarer;
+	};
+
+	struct simulation_t {
+		deal_t deal;
+		deal_constraints_t constraints;
+		player_t declarers[2];			// our side
+		bool vulnerable;
+		unsigned long long seed;
+		unsigned long most;
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		unsigned long deals;
+		unsigned long tricks[2][5][14];	// [declarer][trumps][tricks]: the number of deals
+		int running;
+		bool stop;
+		bool impossible;
+	};
+
+	// Run on each thread: deal, solve the table, and add it in
+	void simulate(simulation_t* sim, int stream)
+	{
+		dealer_t* dealer = new_dealer(&sim->constraints, sim->seed, stream);
+		deal_t d = sim->deal;
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lock(sim->mutex);
+				if (sim->stop) break;
+			}
+			if (!next_deal(dealer, &d)) {
+				std::lock_guard<std::mutex> lock(sim->mutex);
+				sim->impossible = sim->stop = true;
+				break;
+			}
+			deal_analysis_t analysis;
+			analyze_deal(&d, &analysis, 0);
+
+			std::lock_guard<std::mutex> lock(sim->mutex);
+			if (sim->deals >= sim->most) break;
+			if (++sim->deals == sim->most) sim->stop = true;
+			for (int i = 0; i < 2; ++i)
+				for (int s = 0; s <= 4; ++s)
+					sim->tricks[i][s][analysis.tricks[sim->declarers[i]][s]]++;
+			sim->changed.notify_all();
+		}
+		free_dealer(dealer);
+		std::lock_guard<std::mutex> lock(sim->mutex);
+		sim->running--;
+		sim->changed.notify_all();
+	}
+
+	// The chance of making, the expected score, and the 95% half-width of that, from the trick counts
+	double make_probability(const simulation_t& sim, const unsigned long* tricks, int level)
+	{
+		unsigned long made = 0;
+		for (int t = level + 6; t <= 13; ++t) made += tricks[t];
+		return double(made) / sim.deals;
+	}
+	double expected_score(const simulation_t& sim, const unsigned long* tricks, const contract_t& c, double* error)
+	{
+		double sum = 0, squares = 0;
+		for (int t = 0; t <= 13; ++t) {
+			const double score = contract_score(c.trumps, c.level, t, sim.vulnerable, 0);
+			sum += tricks[t] * score;
+			squares += tricks[t] * score * score;
+		}
+		const double n = double(sim.deals), mean = sum / n;
+		if (error) *error = (n > 1) ? 1.96 * sqrt(std::max(0.0, (squares - n*mean*mean) / (n - 1)) / n) : 0;
+		return mean;
+	}
+
+	// Every contract we could play, best expected score first
+	std::vector<contract_t> ranking(const simulation_t& sim)
+	{
+		std::vector<contract_t> all;
+		std::vector<double> scores;
+		for (int i = 0; i < 2; ++i)
+			for (int s = 0; s <= 4; ++s)
+				for (int level = 1; level <= 7; ++level) {
+					const contract_t c = { level, suit_t(s), sim.declarers[i] };
+					all.push_back(c);
+				}
+		for (size_t k = 0; k < all.size(); ++k)
+			scores.push_back(expected_score(sim, sim.tricks[all[k].declarer == sim.declarers[0] ? 0 : 1][all[k].trumps], all[k], 0));
+		std::vector<int> order(all.size());
+		for (size_t k = 0; k < order.size(); ++k) order[k] = int(k);
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return scores[a] > scores[b]; });
+		std::vector<contract_t> rv;
+		for (size_t k = 0; k < order.size(); ++k) rv.push_back(all[order[k]]);
+		return rv;
+	}
+
+	void print_contracts(const simulation_t& sim, int lines)
+	{
+		const std::vector<contract_t> order = ranking(sim);
+		for (int k = 0; k < lines; ++k) {
+			const contract_t& c = order[k];
+			const unsigned long* tricks = sim.tricks[c.declarer == sim.declarers[0] ? 0 : 1][c.trumps];
+			double error;
+			const double score = expected_score(sim, tricks, c, &error);
+			std::cout << "  " << c.level << suittext(c.trumps) << " by " << playertext(c.declarer) << std::fixed
+				<< std::setprecision(1) << std::setw(7) << 100 * make_probability(sim, tricks, c.level) << "%"
+				<< std::setprecision(0) << std::setw(7) << score << " +/-" << error << std::endl;
+		}
+	}
+}
+
+// Deal the other hands at random, within the constraints, solve the double-dummy table of each, and report
+// the chance of making each contract our side could play and its expected score (undoubled), improving
+// the estimates as the deals come in
+void contracts(const deal_t& d, partnership_t side, bool vulnerable, const deal_constraints_t& constraints, unsigned long deals, unsigned long long seed, int threads)
+{
+	simulation_t sim;
+	sim.deal = d;
+	sim.constraints = constraints;
+	for (int c = 0; c < 52; ++c)
+		if (d.holder[c] != plNone) sim.constraints.holder[c] = d.holder[c];
+	sim.declarers[0] = player_t(side);
+	sim.declarers[1] = partner(player_t(side));
+	sim.vulnerable = vulnerable;
+	sim.seed = seed;
+	sim.most = deals;
+	sim.deals = 0;
+	for (int i = 0; i < 2; ++i)
+		for (int s = 0; s <= 4; ++s)
+			for (int t = 0; t <= 13; ++t)
+				sim.tricks[i][s][t] = 0;
+	sim.running = threads;
+	sim.stop = false;
+	sim.impossible = false;
+
+	std::cout << "Contract    Make  Score" << std::endl;
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; ++i)
+		pool.push_back(std::thread(simulate, &sim, i));
+	{
+		std::unique_lock<std::mutex> lock(sim.mutex);
+		unsigned long reported = 25;
+		while (sim.running > 0) {
+			sim.changed.wait(lock);
+			if (sim.stop || sim.deals < reported) continue;
+			reported *= 2;
+			std::cout << sim.deals << " deals:" << std::endl;
+			print_contracts(sim, 3);
+		}
+	}
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+
+	if (sim.impossible) std::cout << "Can't deal hands that meet the constraints" << std::endl;
+	if (sim.deals == 0) return;
+	std::cout << sim.deals << " deals:" << std::endl;
+	print_contracts(sim, 10);
+
+	// The chance of each number of tricks, for each declarer and strain
+	std::cout << std::endl << "Tricks, %:  ";
+	for (int t = 0; t <= 13; ++t)
+		std::cout << std::setw(5) << t;
+	std::cout << std::endl;
+	for (int i = 0; i < 2; ++i)
+		for (int s = nt; s >= cx; --s) {
+			std::cout << "  " << suittext(suit_t(s)) << " by " << playertext(sim.declarers[i]) << "    ";
+			for (int t = 0; t <= 13; ++t)
+				std::cout << std::setw(5) << std::setprecision(0) << 100.0 * sim.tricks[i][s][t] / sim.deals;
+			std::cout << std::endl;
+		}
+}
@@ -0,0 +1,164 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Conversion between binary deal and result files and their text equivalents: a deal per line as
+//  written by serialise_deal, followed by the board number, or a result per line as the table (one hex
+//  digit per entry, [declarer][trumps]) followed by the par contract, declarer, tricks and score, or '-'
+//  for a deal that has no result
+//
+
+#include "corpus.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+
+// Reading deals, from the records mode
+bool parse_deal(const std::string& text, deal_t& deal);
+
+namespace {
+
+	inline char suittext(suit_t suit) { return "CDHSN"[suit]; }
+	inline char playertext(player_t pl) { return "NESWP"[pl]; }
+	inline int hexdigit(char c) { return int(std::string("0123456789abcd").find(c)); }
+
+	std::string result_text(const deal_analysis_t& analysis, const result_t& result)
+	{
+		std::ostringstream out;
+		for (int pl = 0; pl < 4; ++pl)
+			for (int s = 0; s <= 4; ++s)
+				out << "0123456789abcd"[analysis.tricks[pl][s]];
+		out << ' ' << result.level << suittext(result.trumps) << ' ' << playertext(result.declarer);
+		out << ' ' << result.tricks << ' ' << result.score;
+		return out.str();
+	}
+
+	// "<deal>:<declarer><trumps>" as written by serialise_deal, checked before it's taken in
+	bool read_deal(const std::string& line, deal_t& deal)
+	{
+		std::string::size_type colon = line.find(':');
+		if (colon == std::string::npos || line.size() < colon + 3) return false;
+		const std::string::size_type declarer = std::string("NESW").find(toupper(line[colon+1]));
+		const std::string::size_type trumps = std::string("CDHSN").find(toupper(line[colon+2]));
+		if (declarer == std::string::npos || trumps == std::string::npos) return false;
+		if (!parse_deal("N:" + line.substr(0, colon), deal)) return false;
+		deal.declarer = player_t(declarer);
+		deal.trumps = suit_t(trumps);
+		return true;
+	}
+
+	bool parse_result(const std::string& line, deal_analysis_t& analysis, result_t& result)
+	{
+		std::istringstream in(line);
+		std::string table, contract, declarer;
+		if (!(in >> table >> contract >> declarer >> result.tricks >> result.score)) return false;
+		if (table.size() != 20 || contract.size() != 2 || declarer.size() != 1) return false;
+		for (int i = 0; i < 20; ++i) {
+			analysis.tricks[i/5][i%5] = hexdigit(table[i]);
+			if (analysis.tricks[i/5][i%5] < 0) return false;
+		}
+		result.level = contract[0] - '0';
+		result.trumps = suit_t(std::string("CDHSN").find(contract[1]));
+		result.declarer = player_t(std::string("NESWP").find(declarer[0]));
+		return result.level >= 0 && result.level <= 7 && result.trumps <= nt && result.declarer <= plNone;
+	}
+
+	// Binary to text
+	void to_text(const corpus_t* corpus, std::ostream& out)
+	{
+		for (unsigned long i = 0; i < corpus_size(corpus); ++i) {
+			if (corpus_kind(corpus) == deal_corpus) {
+				deal_t deal;
+				if (!unpack_deal(&corpus_deals(corpus)[i], &deal)) {
+					std::cerr << "Record " << i << ": not a deal" << std::endl;
+					continue;
+				}
+				char buff[DEAL_SIZE];
+				serialise_deal(&deal, buff);
+				out << buff << ' ' << deal.board << std::endl;
+			} else {
+				deal_analysis_t analysis;
+				result_t result;
+				if (unpack_result(&corpus_results(corpus)[i], &analysis, &result))
+					out << result_text(analysis, result) << std::endl;
+				else
+					out << '-' << std::endl;
+			}
+		}
+	}
+
+	// Text to binary; the kind of record is decided by the first line
+	bool to_binary(std::istream& in, FILE* out)
+	{
+		std::string line;
+		int lineno = 0;
+		bool started = false;
+		corpus_kind_t kind = deal_corpus;
+		while (std::getline(in, line)) {
+			lineno++;
+			if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+			if (!started) {
+				kind = (line.find(':') != std::string::npos) ? deal_corpus : result_corpus;
+				if (!write_corpus_header(out, kind)) return false;
+				started = true;
+			}
+			if (kind == deal_corpus) {
+				deal_t deal;
+				if (!read_deal(line, deal)) {
+					std::cerr << "Line " << lineno << ": can't read the deal" << std::endl;
+					continue;
+				}
+				deal.board = atoi(line.c_str() + line.find(':') + 3);
+				deal_record_t rec;
+				pack_deal(&deal, &rec);
+				if (fwrite(&rec, sizeof(rec), 1, out) != 1) return false;
+			} else {
+				deal_analysis_t analysis;
+				result_t result;
+				result_record_t rec;
+				std::string first;
+				std::istringstream(line) >> first;
+				if (first == "-") {
+					pack_no_result(&rec);
+				} else if (!parse_result(line, analysis, result)) {
+					std::cerr << "Line " << lineno << ": can't read the result" << std::endl;
+					continue;
+				} else {
+					pack_result(&analysis, &result, &rec);
+				}
+				if (fwrite(&rec, sizeof(rec), 1, out) != 1) return false;
+			}
+		}
+		return started || write_corpus_header(out, kind);
+	}
+}
+
+// Convert a binary file to text, or text to binary
+void convert(const std::string& from, const std::string& to)
+{
+	corpus_t* corpus = open_corpus(from.c_str());
+	if (corpus) {
+		std::ofstream file(to.c_str());
+		if (!file) std::cerr << "Can't write " << to << std::endl;
+		else to_text(corpus, file);
+		close_corpus(corpus);
+		return;
+	}
+
+	std::ifstream in(from.c_str());
+	if (!in) {
+		std::cerr << "Can't open " << from << std::endl;
+		return;
+	}
+	FILE* out = fopen(to.c_str(), "wb");
+	if (!out) {
+		std::cerr << "Can't write " << to << std::endl;
+		return;
+	}
+	if (!to_binary(in, out)) std::cerr << "Error writing " << to << std::endl;
+	fclose(out);
+}
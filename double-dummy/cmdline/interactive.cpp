@@ -6,10 +6,15 @@
 //
 
 #include "analyzer.h"
+#include "async.h"
 #include "controller.h"
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 namespace {
 
@@ -215,7 +220,7 @@ namespace {
                     draw_card(loc);
                     loc.where = inhand;
                     for (int s = 0; s < 4; ++s) {
-                        loc.suit = -(s);
+                        loc.suit = s;
                         draw_annotated_card(loc);
                     }
                 }
@@ -284,9 +289,11 @@ namespace {
     }
     
 	inline card_t card(const std::string& str) {
-		suit_t s = suit_t(std::string("CDHSN").find(toupper(str[0])));
-		rank_t r = rank_t(std::string("23456789TJQKA").find(toupper(str[1])));
-		return card(s, r);
+		if (str.size() != 2) return -1;
+		size_t s = std::string("CDHS").find(toupper(str[0]));
+		size_t r = std::string("23456789TJQKA").find(toupper(str[1]));
+		if (s == std::string::npos || r == std::string::npos) return -1;
+		return card(suit_t(s), rank_t(r));
 	}
 
 	std::ostream& operator<<(std::ostream& out, bound_t& bound) {
@@ -298,22 +305,63 @@ namespace {
 		return out;
 	}
 
-	int callback(position_analysis_t* pos)
+	// Shows the latest results from a background analysis, if they're still relevant. Returns 1 if
+	// the analysis has finished.
+	int show_analysis(controller_info_t* info, analysis_job_t* job, int nCardsPlayed)
 	{
-        controller_info_t* info = (controller_info_t*)pos->context;
         gui_t* gui = (gui_t*)info->context;
+        position_analysis_t pos;
+        const int finished = poll_analysis(job, &pos);
         card_changes_t changes;
         changes.num_changes = 0;
         changes.pause_after = -1;    
-        update_for_analysis(info, &changes);
+        if (update_for_background_analysis(info, &changes, nCardsPlayed, analysis_context(job), &pos) != 0) return finished;
         gui->summary[pNS] = info->view.summary[pNS];
         gui->summary[pEW] = info->view.summary[pEW];
         gui->draw_summary();
         process_changes(gui, &changes);
         gui->display();
-		return true;
+        std::cout << "Play: " << std::flush;
+        return finished;
 	}
 
+    // Stops pondering, keeping whatever it found out about the plays available
+    void stop_pondering(controller_info_t* info, ponder_t* ponder)
+    {
+        stop_pondering(ponder);
+        for (int c = 0; c < 52; ++c) {
+            position_analysis_t pos;
+            if (info->cardstate[c].state == playable && ponder_result(ponder, c, &pos) >= 0)
+                update_for_ponder(info, c, &pos);
+        }
+        free_pondering(ponder);
+    }
+
+    // Reads the user's input on its own thread, so that the analysis can carry on while they think
+    struct input_t
+    {
+        std::mutex mutex;
+        std::deque<std::string> lines;
+
+        void run()
+        {
+            std::string str;
+            while (std::cin >> str) {
+                std::lock_guard<std::mutex> lock(mutex);
+                lines.push_back(str);
+            }
+        }
+
+        bool get(std::string& str)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (lines.empty()) return false;
+            str = lines.front();
+            lines.pop_front();
+            return true;
+        }
+    };
+
 }
 
 // Interactive mode
@@ -326,26 +374,62 @@ void interactive(const deal_t& d)
     info.context = &gui;
     info.deal = d;
     info.play.nCardsPlayed = 0;
+    info.nextcontext = 0;
     initialise_view(&info, true);
     
     // Initialise GUI
     gui.initialise(info.view);
+    input_t input;
+    std::thread(&input_t::run, &input).detach();
     std::string str;
+    const int ponder_threads = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+    std::cout << "Enter a card to play (e.g. SA), or u to undo, r to redo, f to play the best card, p to play out the hand" << std::endl;
     
 	// Main loop
     card_changes_t changes;
-	while (true) {
-        info.analysis[info.play.nCardsPlayed].context = &info;
-		analyze(&d, &info.play, cache, callback, &info.analysis[info.play.nCardsPlayed], true);
+	while (info.play.nCardsPlayed < 52) {
+        const int n = info.play.nCardsPlayed;
+        analysis_job_t* job = start_analysis(&d, &info.play, cache, &info.analysis[n], all_moves, info.playcontext[n]);
 	    gui.display();
+        std::cout << "Play: " << std::flush;
+
+        // Keep the display up to date until we get a legal play or a command. Once the analysis
+        // is done, get ahead by looking at the positions the user might go to next.
+        card_t c = -1;
+        ponder_t* ponder = 0;
+        while (true) {
+            if (wait_analysis(job, 50) && show_analysis(&info, job, n) && !ponder)
+                ponder = start_pondering(&d, &info.play, cache, &info.analysis[n], ponder_threads);
+            if (!input.get(str)) continue;
+            if (str == "u" || str == "r" || str == "f" || str == "p") break;
+            c = card(str);
+            if (c >= 0 && info.cardstate[c].state == playable) break;
+            std::cout << "Play: " << std::flush;
+        }
+
+        // Stop the analysis, keeping what it's found so far
+        if (ponder) stop_pondering(&info, ponder);
+        cancel_analysis(job);
+        position_analysis_t pos;
+        while (!poll_analysis(job, &pos)) wait_analysis(job, -1);
+        show_analysis(&info, job, n);
+        free_analysis(job);
+
         changes.num_changes = 0;
         changes.pause_after = -1;    
-    ASK_AGAIN:        
-        std::cout << "Play: ";
-        std::cin >> str;
-        card_t c = card(str);        
-        const int rv = update_for_play(&info, &changes, c);           
-        if (rv != 0) goto ASK_AGAIN;
+        if (str == "u") update_for_undo(&info, &changes);
+        else if (str == "r") update_for_redo(&info, &changes);
+        else if (str == "f") update_for_forward(&info, &changes);
+        else if (str == "p") {
+            play_t line;
+            optimal_line(&d, &info.play, cache, &line);
+            for (int i = n; i < line.nCardsPlayed; ++i) {
+                if (i > n) process_changes(&gui, &changes);
+                update_for_play(&info, &changes, line.played[i]);
+            }
+        }
+        else update_for_play(&info, &changes, c);           
         process_changes(&gui, &changes);
 	}
+    gui.display();
 }
@@ -0,0 +1,81 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Contract and lead analysis over every layout of the east-west cards
+//
+
+#include "layouts.h"
+#include <iostream>
+#include <iomanip>
+
+namespace {
+
+	inline char suittext(suit_t suit) { return "CDHSN"[suit]; }
+	inline char suittext(card_t c) { return suittext(suit(c)); }
+	inline char ranktext(card_t c) { return "23456789TJQKA"[rank(c)]; }
+
+	// The chance of making each level, in one line
+	void print_levels(const layout_result_t* result, card_t lead)
+	{
+		for (int level = 1; level <= 7; ++level)
+			std::cout << std::setw(6) << std::fixed << std::setprecision(1) << 100 * make_probability(result, 6 + level, lead);
+	}
+
+	// Reports whenever the estimates get tighter
+	int progress(layout_result_t* result)
+	{
+		double* shown = (double*)result->context;
+		if (int(1000 * result->error) >= int(1000 * *shown)) return 1;
+		*shown = result->error;
+		std::cout << result->solved << " solved, +/-" << std::fixed << std::setprecision(1) << 100 * result->error << "%:";
+		print_levels(result, -1);
+		std::cout << std::endl;
+		return 1;
+	}
+}
+
+// Solve every layout (or enough of them) and report the chance of making each level
+void layouts(const deal_t& d, const deal_constraints_t& constraints, bool leads, double tolerance, int threads)
+{
+	layout_query_t query;
+	query.deal = d;
+	query.east = constraints.hand[plE];
+	query.west = constraints.hand[plW];
+	query.leads = leads ? 1 : 0;
+	query.tolerance = tolerance;
+	query.threads = threads;
+	layout_result_t result;
+	double shown = 1;
+	result.context = &shown;
+	std::cout << "Level:";
+	for (int level = 1; level <= 7; ++level)
+		std::cout << std::setw(6) << level;
+	std::cout << std::endl;
+	enumerate_layouts(&query, progress, &result);
+
+	std::cout << result.examined << " layouts examined, " << result.consistent << " consistent, " << result.solved << " solved";
+	if (result.complete) std::cout << " (all of them)";
+	else std::cout << ", +/-" << std::fixed << std::setprecision(1) << 100 * result.error << "%";
+	std::cout << std::endl;
+	std::cout << "Tricks: ";
+	for (int t = 0; t <= 13; ++t)
+		std::cout << ' ' << result.tricks[t];
+	std::cout << std::endl << "Make %:";
+	print_levels(&result, -1);
+	std::cout << std::endl;
+	if (!leads) return;
+
+	// Leads, from the top of each suit
+	for (int s = sx; s >= cx; --s)
+		for (card_t c = card(suit_t(s), 12); c >= 0; c -= 4) {
+			if (!result.leads[c]) continue;
+			double average = 0;
+			for (int t = 0; t <= 13; ++t)
+				average += t * double(result.lead_tricks[c][t]);
+			average /= result.leads[c];
+			std::cout << suittext(c) << ranktext(c) << std::setw(8) << result.leads[c] << std::setw(7) << std::setprecision(2) << average;
+			print_levels(&result, c);
+			std::cout << std::endl;
+		}
+}
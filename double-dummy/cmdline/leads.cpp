@@ -2,12 +2,21 @@
 // It is made available under the GPL; see the file COPYING for details
 
 //
-//  Opening lead analysis
+//  Opening lead analysis: double-dummy on a known deal, or by simulation knowing only the leader's hand
 //
 
 #include "analyzer.h"
+#include "dealer.h"
 #include <iostream>
+#include <iomanip>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cmath>
 
 namespace {
 
@@ -28,6 +37,134 @@ namespace {
 		return true;
 	}
 
+	// What the simulation has found for each lead, from the defenders' side
+	struct lead_tally_t {
+		card_t card;
+		double deals, tricks, squares, sets;
+	};
+
+	// The leads are ranked by the chance of beating the contract, then by the tricks the defence takes;
+	// this puts both in one number for comparing leads deal by deal
+	inline double merit(int tricks, int needed) { return (tricks >= needed ? 1 : 0) + tricks / 14.0; }
+
+	struct simulation_t {
+		deal_t deal;
+		deal_constraints_t constraints;
+		int needed;						// tricks the defence needs to beat the contract
+		int count;						// leads
+		unsigned long long seed;
+		unsigned long most;				// deals
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::vector<lead_tally_t> leads;
+		std::vector<double> difference, squared;	// of the merits of each pair of leads, [i*count + j]
+		unsigned long deals;
+		int running;
+		bool stop;
+		bool impossible;
+	};
+
+	// Run on each thread: deal, solve every lead, and add the results in
+	void simulate(simulation_t* sim, int stream)
+	{
+		dealer_t* dealer = new_dealer(&sim->constraints, sim->seed, stream);
+		cache_t* cache = new_cache();
+		deal_t d = sim->deal;
+		play_t play;
+		play.nCardsPlayed = 0;
+		std::vector<int> tricks(sim->count);
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lock(sim->mutex);
+				if (sim->stop) break;
+			}
+			if (!next_deal(dealer, &d)) {
+				std::lock_guard<std::mutex> lock(sim->mutex);
+				sim->impossible = sim->stop = true;
+				break;
+			}
+			position_analysis_t pos;
+			pos.global.low = 0;
+			pos.global.high = 1 + 13;
+			for (int i = 0; i < 52; ++i)
+				pos.play[i] = pos.global;
+			clear_cache(cache);
+			analyze(&d, &play, cache, 0, &pos, all_moves);
+			for (int i = 0; i < sim->count; ++i)
+				tricks[i] = pos.play[sim->leads[i].card].low;
+
+			std::lock_guard<std::mutex> lock(sim->mutex);
+			if (sim->deals >= sim->most) break;
+			if (++sim->deals == sim->most) sim->stop = true;
+			for (int i = 0; i < sim->count; ++i) {
+				lead_tally_t& t = sim->leads[i];
+				t.deals++;
+				t.tricks += tricks[i];
+				t.squares += tricks[i] * tricks[i];
+				if (tricks[i] >= sim->needed) t.sets++;
+				for (int j = 0; j < sim->count; ++j) {
+					const double d = merit(tricks[i], sim->needed) - merit(tricks[j], sim->needed);
+					sim->difference[i*sim->count + j] += d;
+					sim->squared[i*sim->count + j] += d*d;
+				}
+			}
+			sim->changed.notify_all();
+		}
+		free_cache(cache);
+		free_dealer(dealer);
+		std::lock_guard<std::mutex> lock(sim->mutex);
+		sim->running--;
+		sim->changed.notify_all();
+	}
+
+	// Leads in order, best first
+	std::vector<int> ranking(const simulation_t& sim)
+	{
+		std::vector<int> order(sim.count);
+		for (int i = 0; i < sim.count; ++i) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+			return sim.leads[a].sets + sim.leads[a].tricks / 14 > sim.leads[b].sets + sim.leads[b].tricks / 14;
+		});
+		return order;
+	}
+
+	// The ranking is settled once each lead is either clearly better than the next (at 95%), or so close
+	// to it that the order doesn't matter
+	const double indifference = 0.01;
+	bool settled(const simulation_t& sim, const std::vector<int>& order)
+	{
+		const double n = double(sim.deals);
+		if (n < 100) return false;
+		for (int k = 0; k + 1 < sim.count; ++k) {
+			const int i = order[k] * sim.count + order[k+1];
+			const double mean = sim.difference[i] / n;
+			const double sd = sqrt(std::max(0.0, sim.squared[i] / n - mean*mean));
+			const double width = 1.96 * sd / sqrt(n);
+			if (mean - width <= 0 && mean + width >= indifference) return false;
+		}
+		return true;
+	}
+
+	// 95% half-width of the mean of the values tallied
+	double half_width(double n, double sum, double squares)
+	{
+		if (n < 2) return 0;
+		const double mean = sum / n;
+		return 1.96 * sqrt(std::max(0.0, (squares - n*mean*mean) / (n - 1)) / n);
+	}
+
+	void print_leads(const simulation_t& sim, const std::vector<int>& order, int lines)
+	{
+		for (int k = 0; k < std::min(lines, sim.count); ++k) {
+			const lead_tally_t& t = sim.leads[order[k]];
+			const double p = t.sets / t.deals;
+			std::cout << "  " << suittext(t.card) << ranktext(t.card) << std::fixed << std::setprecision(1)
+				<< std::setw(7) << 100 * p << "% +/-" << std::setw(4) << 100 * half_width(t.deals, t.sets, t.sets)
+				<< std::setprecision(2) << std::setw(7) << t.tricks / t.deals << " +/-" << std::setw(4) << half_width(t.deals, t.tricks, t.squares)
+				<< std::endl;
+		}
+	}
 }
 
 void leads(const deal_t& d) 
@@ -51,7 +188,67 @@ void leads(const deal_t& d)
 		pos.play[i].low = 0;
 		pos.play[i].high = pos.global.high;
 	}
-	analyze(&d, &play, cache, callback, &pos, true);
+	analyze(&d, &play, cache, callback, &pos, all_moves);
 	std::cout << pos.global.low << std::endl;
 }
 
+
+// Opening leads against a contract, knowing only the leader's hand (and any others given): deal the
+// rest at random, within the constraints, and solve every lead on each deal, until the order of the
+// leads is settled or we've dealt as many as we're allowed
+void lead_simulation(const deal_t& d, int level, const deal_constraints_t& constraints, unsigned long deals, unsigned long long seed, int threads)
+{
+	simulation_t sim;
+	sim.deal = d;
+	sim.constraints = constraints;
+	for (int c = 0; c < 52; ++c)
+		if (d.holder[c] != plNone) sim.constraints.holder[c] = d.holder[c];
+	const player_t leader = nextpl(d.declarer);
+	for (card_t c = 51; c >= 0; --c) {
+		if (d.holder[c] != leader) continue;
+		lead_tally_t t = { c, 0, 0, 0, 0 };
+		sim.leads.push_back(t);
+	}
+	sim.count = int(sim.leads.size());
+	if (sim.count != 13) {
+		std::cout << "The leader needs a hand of 13 cards" << std::endl;
+		return;
+	}
+	sim.needed = 8 - level;
+	sim.seed = seed;
+	sim.most = deals;
+	sim.difference.assign(sim.count * sim.count, 0);
+	sim.squared.assign(sim.count * sim.count, 0);
+	sim.deals = 0;
+	sim.running = threads;
+	sim.stop = false;
+	sim.impossible = false;
+
+	std::cout << "Lead      Set          Tricks" << std::endl;
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; ++i)
+		pool.push_back(std::thread(simulate, &sim, i));
+
+	// Report the leading leads as the numbers grow, and stop once their order is settled
+	{
+		std::unique_lock<std::mutex> lock(sim.mutex);
+		unsigned long reported = 50;
+		while (sim.running > 0) {
+			sim.changed.wait(lock);
+			if (sim.stop || sim.deals < reported) continue;
+			reported *= 2;
+			const std::vector<int> order = ranking(sim);
+			std::cout << sim.deals << " deals:" << std::endl;
+			print_leads(sim, order, 3);
+			if (settled(sim, order)) sim.stop = true;
+		}
+	}
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+
+	if (sim.impossible) std::cout << "Can't deal hands that meet the constraints" << std::endl;
+	if (sim.deals == 0) return;
+	const std::vector<int> order = ranking(sim);
+	std::cout << sim.deals << " deals" << (settled(sim, order) ? ", order settled:" : ":") << std::endl;
+	print_leads(sim, order, sim.count);
+}
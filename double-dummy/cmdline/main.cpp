@@ -2,15 +2,31 @@
 // It is made available under the GPL; see the file COPYING for details
 
 #include "types.h"
+#include "store.h"
+#include "dealer.h"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 // Different analysis modes; each is in their own source file
 void leads(const struct deal_t& deal);
-void par(struct deal_t deal);
+void contracts(const struct deal_t& d, partnership_t side, bool vulnerable, const struct deal_constraints_t& constraints, unsigned long deals, unsigned long long seed, int threads);
+void single_dummy(const struct deal_t& d, const struct deal_constraints_t& constraints, unsigned long long seed, int threads);
+void lead_simulation(const struct deal_t& d, int level, const struct deal_constraints_t& constraints, unsigned long deals, unsigned long long seed, int threads);
+void par(struct deal_t deal, struct result_store_t* store);
+void quickpar(struct deal_t deal);
+void records(const std::string& filename, int threads, const std::string& output, struct result_store_t* store);
+void convert(const std::string& from, const std::string& to);
+void annotate(const std::string& filename, int threads);
+void layouts(const struct deal_t& d, const struct deal_constraints_t& constraints, bool leads, double tolerance, int threads);
 void test_main();
+void benchmark(int deals);
+void cache_benchmark(int deals);
 void interactive(const struct deal_t& deal);
 
 // Convert a string to a hand
@@ -39,8 +55,23 @@ void usage()
 	std::cout << "\tSpecify trumpsuit via -t" << std::endl;
 	std::cout << "\tSpecify board number via -b" << std::endl;
 	std::cout << "\tSpecify a par analysis via -p" << std::endl;
+	std::cout << "\tSpecify a par result without the full table via -q" << std::endl;
 	std::cout << "\tSpecify an opening-lead analysis via -l" << std::endl;
+	std::cout << "\tPar analysis for a file of deals (PBN, one per line, or binary) via -rfile, or -r- for standard input" << std::endl;
+	std::cout << "\tSpecify the number of threads for -r, -a, -E, -m, -i and -u via -j" << std::endl;
+	std::cout << "\tWrite the results of -r to a binary file via -ofile" << std::endl;
+	std::cout << "\tKeep the tables solved by -p and -r in a store, to skip deals seen before, via -Sfile" << std::endl;
+	std::cout << "\tAnnotate each card of a file of played hands (deal, then play) via -afile, or -a- for standard input" << std::endl;
+	std::cout << "\tMake-probabilities over every layout of the east-west cards (given -n, -s, -d, -t) via -E, or stop once within p% via -Ep; with -l, for each lead too" << std::endl;
+	std::cout << "\tSimulate opening leads against a contract such as 3N via -m3N, given -d and the leader's hand" << std::endl;
+	std::cout << "\tPlay single-dummy, with advice for declarer, via -i, given -d, -t and declarer's and dummy's hands" << std::endl;
+	std::cout << "\tSimulate the choice of contract for one partnership via -u, given both its hands, and -v if it's vulnerable" << std::endl;
+	std::cout << "\tSpecify the most deals for -m and -u via -k, and the random seed for -m, -i and -u via -g" << std::endl;
+	std::cout << "\tConstrain the hands that are dealt via -c, e.g. -cW:12-14S5-,E:-9H-2 (points, then suit lengths)" << std::endl;
+	std::cout << "\tConvert a binary deal or result file to text, or back, via -xfile -ofile" << std::endl;
 	std::cout << "\tRun tests with -T (other inputs ignored)" << std::endl;
+	std::cout << "\tBenchmark the trick estimate on n random deals with -Bn (other inputs ignored)" << std::endl;
+	std::cout << "\tBenchmark cache policies on n random deals with -Cn (other inputs ignored)" << std::endl;
 	std::cout << "Any missing information will be requested" << std::endl;
 	exit(0);
 }
@@ -76,10 +107,63 @@ std::string get_option_dflt(char c, const std::string& dflt, const opt_t& opt)
 	return dflt;
 }
 
+// The store of solved deals, if the user wants one
+result_store_t* get_store(const opt_t& opt)
+{
+	opt_t::const_iterator it = opt.find('S');
+	if (it == opt.end()) return 0;
+	result_store_t* store = open_result_store(it->second.c_str());
+	if (!store) std::cout << "Can't open the store " << it->second << std::endl;
+	return store;
+}
+
 // Char -> player / suit
 inline player_t player(char c) { return player_t(std::string("NESW").find(toupper(c))); }
 inline suit_t suit(char c) { return suit_t(std::string("CDHSN").find(toupper(c))); }
 
+// A range such as "12-14", "5-" (at least), "-2" (at most) or "4" (exactly); leaves the limits alone if
+// there's no range there
+void range(const std::string& str, size_t& i, int& low, int& high)
+{
+	size_t start = i;
+	while (i < str.size() && isdigit(str[i])) i++;
+	if (i > start) low = high = atoi(str.c_str() + start);
+	if (i < str.size() && str[i] == '-') {
+		if (i == start) low = 0;
+		start = ++i;
+		while (i < str.size() && isdigit(str[i])) i++;
+		if (i > start) high = atoi(str.c_str() + start);
+	}
+}
+
+// Constraints on the hands dealt, from -c: for each seat, "seat:" then a range of points and then a suit
+// letter and range of lengths for each suit that matters, with the seats separated by commas
+deal_constraints_t get_constraints(const opt_t& opt)
+{
+	deal_constraints_t constraints;
+	no_constraints(&constraints);
+	opt_t::const_iterator it = opt.find('c');
+	if (it == opt.end()) return constraints;
+	const std::string& str = it->second;
+	size_t i = 0;
+	while (i + 1 < str.size()) {
+		const player_t pl = player(str[i]);
+		if (pl > plW || str[i+1] != ':') usage();
+		hand_constraint_t& h = constraints.hand[pl];
+		i += 2;
+		h.max_hcp = 37;
+		range(str, i, h.min_hcp, h.max_hcp);
+		while (i < str.size() && str[i] != ',') {
+			const suit_t s = suit(str[i++]);
+			if (s > sx) usage();
+			h.max_length[s] = 13;
+			range(str, i, h.min_length[s], h.max_length[s]);
+		}
+		if (i < str.size()) i++;
+	}
+	return constraints;
+}
+
 // Entry point
 int main(int argc, char* argv[])
 {
@@ -91,6 +175,123 @@ int main(int argc, char* argv[])
         test_main();
         return 0;
 	}
+
+    // Benchmark mode
+    if (opt.find('B') != opt.end()) {
+        benchmark(std::max(1, atoi(opt['B'].c_str())));
+        return 0;
+	}
+    if (opt.find('C') != opt.end()) {
+        cache_benchmark(std::max(1, atoi(opt['C'].c_str())));
+        return 0;
+	}
+    
+    // Hand records
+    if (opt.find('r') != opt.end()) {
+        const int threads = atoi(get_option_dflt('j', "0", opt).c_str());
+        result_store_t* store = get_store(opt);
+        records(opt['r'].empty() ? "-" : opt['r'], threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())), get_option_dflt('o', "", opt), store);
+        if (store) close_result_store(store);
+        return 0;
+	}
+
+    // Played hands
+    if (opt.find('a') != opt.end()) {
+        const int threads = atoi(get_option_dflt('j', "0", opt).c_str());
+        annotate(opt['a'].empty() ? "-" : opt['a'], threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())));
+        return 0;
+	}
+
+    // Every layout
+    if (opt.find('E') != opt.end()) {
+        deal_t d;
+        for (int c = 0; c < 52; ++c) d.holder[c] = plNone;
+        std::vector<card_t> north = hand(get_option_prompt('n', "North", opt)), south = hand(get_option_prompt('s', "South", opt));
+        if (north.size() != 13 || south.size() != 13) usage();
+        for (int i = 0; i < 13; ++i) {
+            d.holder[north[i]] = plN;
+            d.holder[south[i]] = plS;
+        }
+        d.trumps = suit(get_option_prompt('t', "Trumps", opt)[0]);
+        d.declarer = player(get_option_prompt('d', "Declarer", opt)[0]);
+        const int threads = atoi(get_option_dflt('j', "0", opt).c_str());
+        layouts(d, get_constraints(opt), opt.find('l') != opt.end(), atof(opt['E'].c_str()) / 100, threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())));
+        return 0;
+	}
+
+    // Lead simulation: only the leader's hand (and any others the user knows) is given
+    if (opt.find('m') != opt.end()) {
+        const std::string& contract = opt['m'];
+        if (contract.size() != 2 || contract[0] < '1' || contract[0] > '7' || suit(contract[1]) > nt) usage();
+        deal_t d;
+        for (int c = 0; c < 52; ++c) d.holder[c] = plNone;
+        d.trumps = suit(contract[1]);
+        d.declarer = player(get_option_prompt('d', "Declarer", opt)[0]);
+        if (d.declarer > plW) usage();
+        const char seats[] = "nesw";
+        for (int pl = 0; pl < 4; ++pl) {
+            std::vector<card_t> cards;
+            if (player_t(pl) == nextpl(d.declarer)) cards = hand(get_option_prompt(seats[pl], "Leader", opt));
+            else if (opt.find(seats[pl]) != opt.end()) cards = hand(opt[seats[pl]]);
+            else continue;
+            if (cards.size() != 13) usage();
+            for (int i = 0; i < 13; ++i)
+                d.holder[cards[i]] = player_t(pl);
+        }
+        const int threads = atoi(get_option_dflt('j', "0", opt).c_str());
+        lead_simulation(d, contract[0] - '0', get_constraints(opt), std::max(1, atoi(get_option_dflt('k', "1000", opt).c_str())),
+            strtoull(get_option_dflt('g', "1", opt).c_str(), 0, 10), threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())));
+        return 0;
+	}
+
+    // Single-dummy play: only declarer's and dummy's hands are given
+    if (opt.find('i') != opt.end()) {
+        deal_t d;
+        for (int c = 0; c < 52; ++c) d.holder[c] = plNone;
+        d.trumps = suit(get_option_prompt('t', "Trumps", opt)[0]);
+        d.declarer = player(get_option_prompt('d', "Declarer", opt)[0]);
+        if (d.declarer > plW) usage();
+        const char seats[] = "nesw";
+        const char* names[] = { "North", "East", "South", "West" };
+        for (int pl = 0; pl < 4; ++pl) {
+            if (partnership(player_t(pl)) != partnership(d.declarer)) continue;
+            std::vector<card_t> cards = hand(get_option_prompt(seats[pl], names[pl], opt));
+            if (cards.size() != 13) usage();
+            for (int i = 0; i < 13; ++i)
+                d.holder[cards[i]] = player_t(pl);
+        }
+        const int threads = atoi(get_option_dflt('j', "0", opt).c_str());
+        single_dummy(d, get_constraints(opt), strtoull(get_option_dflt('g', "1", opt).c_str(), 0, 10),
+            threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())));
+        return 0;
+	}
+
+    // Contract choice: both hands of one partnership are given
+    if (opt.find('u') != opt.end()) {
+        deal_t d;
+        for (int c = 0; c < 52; ++c) d.holder[c] = plNone;
+        const char seats[] = "nesw";
+        const partnership_t side = (opt.find('e') != opt.end() || opt.find('w') != opt.end()) ? pEW : pNS;
+        const char* names[] = { "North", "East", "South", "West" };
+        for (int pl = 0; pl < 4; ++pl) {
+            if (partnership(player_t(pl)) != side) continue;
+            std::vector<card_t> cards = hand(get_option_prompt(seats[pl], names[pl], opt));
+            if (cards.size() != 13) usage();
+            for (int i = 0; i < 13; ++i)
+                d.holder[cards[i]] = player_t(pl);
+        }
+        const int threads = atoi(get_option_dflt('j', "0", opt).c_str());
+        contracts(d, side, opt.find('v') != opt.end(), get_constraints(opt), std::max(1, atoi(get_option_dflt('k', "1000", opt).c_str())),
+            strtoull(get_option_dflt('g', "1", opt).c_str(), 0, 10), threads > 0 ? threads : std::max(1, int(std::thread::hardware_concurrency())));
+        return 0;
+	}
+
+    // Conversion
+    if (opt.find('x') != opt.end()) {
+        if (opt.find('o') == opt.end()) usage();
+        convert(opt['x'], opt['o']);
+        return 0;
+	}
     
     // Assemble deal
 	deal_t d;
@@ -111,7 +312,15 @@ int main(int argc, char* argv[])
 
 		// Par analysis
 		d.board = atoi(get_option_prompt('b', "Board Number", opt).c_str());
-		par(d);
+		result_store_t* store = get_store(opt);
+		par(d, store);
+		if (store) close_result_store(store);
+
+	} else if (opt.find('q') != opt.end()) {
+
+		// Par result only
+		d.board = atoi(get_option_prompt('b', "Board Number", opt).c_str());
+		quickpar(d);
 
 	} else if (opt.find('l') != opt.end()) {
 
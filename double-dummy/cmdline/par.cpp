@@ -3,6 +3,7 @@
 
 #include "analyzer.h"
 #include "par.h"
+#include "store.h"
 #include <iostream>
 
 
@@ -50,28 +51,16 @@ namespace {
 	}
 }				
 
-// Analysis for hand records
-void par(deal_t d)
+void print_par(std::ostream& out, const deal_analysis_t& analysis, const result_t& result);
+
+// Analysis for hand records, looking in the store (if any) first
+void par(deal_t d, result_store_t* store)
 {
-	// Initialise data structures
-	play_t play;	
-	play.nCardsPlayed = 0;
-	position_analysis_t pos;
+	// Figure out how many tricks we can make for each suit, for each declarer
 	deal_analysis_t analysis;
-	
-	// Figure out how man tricks we can make for each suit, for each declarer
-	for (int s = 0; s <= 4; s++) {
-		cache_t* cache = new_cache();
-		d.trumps = suit_t(s);
-		for (int pl = 0; pl < 4; pl++) {
-			d.declarer = player_t(pl);
-			pos.global.low = 0;
-			pos.global.high = 1 + 13;
-			pos.context = &(analysis.tricks[pl][s]);
-			analyze(&d, &play, cache, 0, &pos, false);
-			analysis.tricks[pl][s] = 13-pos.global.low;
-		}
-		free_cache(cache);
+	if (!store || !lookup_result(store, &d, &analysis)) {
+		analyze_deal(&d, &analysis, 0);
+		if (store) store_result(store, &d, &analysis);
 	}
 	
 	// Find par result
@@ -79,7 +68,21 @@ void par(deal_t d)
 	analyze_par(d.board, &analysis, &result);
 
 	// Output everything
-	std::cout << analysis << std::endl;
-	std::cout << "Par: " << result << std::endl;
+	print_par(std::cout, analysis, result);
 }
 
+// The table and par result, as output by par()
+void print_par(std::ostream& out, const deal_analysis_t& analysis, const result_t& result)
+{
+	out << analysis << std::endl;
+	out << "Par: " << result << std::endl;
+}
+
+// Par result only, solving no more of the table than it needs
+void quickpar(deal_t d)
+{
+	result_t result;
+	int searches;
+	solve_par(&d, &result, &searches);
+	std::cout << "Par: " << result << " (" << searches << " searches)" << std::endl;
+}
@@ -0,0 +1,315 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Par analysis for a whole file of hand records. The deals are read and parsed on one thread, solved on
+//  a pool of others, and written out in the order they came in. The queues between the stages are
+//  bounded, so memory stays flat however long the file is. Binary deal files need no reading: each
+//  thread of the pool takes the next few records straight from the file. The results can be written
+//  as text or as a binary result file.
+//
+
+#include "analyzer.h"
+#include "par.h"
+#include "corpus.h"
+#include "store.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+// Output, from the par mode
+void print_par(std::ostream& out, const deal_analysis_t& analysis, const result_t& result);
+
+namespace {
+
+	// A hand record on its way through
+	struct record_t {
+		int index;					// position in the input
+		bool valid;					// false if the deal couldn't be read; it still takes its place in the order
+		deal_t deal;
+		deal_analysis_t analysis;
+		result_t result;
+	};
+
+	// Queue between two stages; the producer waits while it's full, the consumer while it's empty
+	template <class T>
+	class queue_t {
+	public:
+		queue_t(size_t capacity) : m_capacity(capacity), m_closed(false) { }
+
+		void push(const T& t) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_changed.wait(lock, [this] { return m_items.size() < m_capacity; });
+			m_items.push_back(t);
+			m_changed.notify_all();
+		}
+
+		// Returns false once the queue has been closed and emptied
+		bool pop(T& t) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_changed.wait(lock, [this] { return !m_items.empty() || m_closed; });
+			if (m_items.empty()) return false;
+			t = m_items.front();
+			m_items.pop_front();
+			m_changed.notify_all();
+			return true;
+		}
+
+		// No more to come
+		void close() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+			m_changed.notify_all();
+		}
+
+	private:
+		const size_t m_capacity;
+		bool m_closed;
+		std::deque<T> m_items;
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+	};
+
+	// Puts the records back in order. Only so many may be in the pipeline past the next one to be
+	// written, so one slow deal holds up the reader rather than filling memory with later results.
+	// Writes a binary result file if given one, otherwise text.
+	class writer_t {
+	public:
+		writer_t(std::ostream& out, FILE* binary, int window) : m_out(out), m_binary(binary), m_window(window), m_next(0) { }
+
+		// Waits until the record with the given index may enter the pipeline
+		void admit(int index) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_changed.wait(lock, [&] { return index < m_next + m_window; });
+		}
+
+		// Writes the record, and any after it that were waiting, if it's the next one due
+		void put(const record_t& record) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_waiting[record.index] = record;
+			while (!m_waiting.empty() && m_waiting.begin()->first == m_next) {
+				const record_t& r = m_waiting.begin()->second;
+				if (m_binary) {
+					// A placeholder for a record that failed, to keep the results in step with the deals
+					result_record_t rec;
+					if (r.valid) pack_result(&r.analysis, &r.result, &rec);
+					else pack_no_result(&rec);
+					fwrite(&rec, sizeof(rec), 1, m_binary);
+				} else if (r.valid) {
+					m_out << "Board " << r.deal.board << std::endl;
+					print_par(m_out, r.analysis, r.result);
+				}
+				m_waiting.erase(m_waiting.begin());
+				m_next++;
+			}
+			m_changed.notify_all();
+		}
+
+	private:
+		std::ostream& m_out;
+		FILE* m_binary;
+		const int m_window;
+		int m_next;
+		std::map<int, record_t> m_waiting;
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+	};
+
+	inline int seat(char c) { return int(std::string("NESW").find(toupper(c))); }
+}
+
+// Parses a deal given as hands with suits separated by dots (spades first), either in PBN style
+// ("N:hand hand hand hand", clockwise from the first seat) or with a seat before each hand
+// ("N:hand E:hand S:hand W:hand"). Returns false if it isn't a complete deal.
+bool parse_deal(const std::string& text, deal_t& deal)
+{
+	for (int c = 0; c < 52; ++c) deal.holder[c] = plNone;
+	std::istringstream in(text);
+	std::string token;
+	int pl = -1, hands = 0;
+	bool seen[4] = { false, false, false, false };
+	while (in >> token) {
+		std::string::size_type colon = token.find(':');
+		if (colon == 1) {
+			pl = seat(token[0]);
+			token = token.substr(2);
+		} else if (pl >= 0) {
+			pl = (pl + 1) % 4;
+		}
+		if (pl < 0 || pl > 3 || seen[pl]) return false;
+		seen[pl] = true;
+		int s = sx, count = 0;
+		for (std::string::const_iterator it = token.begin(); it != token.end(); ++it) {
+			if (*it == '.') { if (--s < cx) return false; continue; }
+			if (*it == '-') continue;
+			std::string::size_type r = std::string("23456789TJQKA").find(toupper(*it));
+			if (r == std::string::npos) return false;
+			card_t c = card(suit_t(s), rank_t(r));
+			if (deal.holder[c] != plNone) return false;
+			deal.holder[c] = player_t(pl);
+			count++;
+		}
+		if (count != 13) return false;
+		hands++;
+	}
+	return hands == 4;
+}
+
+namespace {
+
+	// The value of a PBN tag such as [Board "12"]
+	bool tag(const std::string& line, const char* name, std::string& value)
+	{
+		const std::string prefix = std::string("[") + name + " \"";
+		if (line.compare(0, prefix.size(), prefix) != 0) return false;
+		std::string::size_type end = line.find('"', prefix.size());
+		if (end == std::string::npos) return false;
+		value = line.substr(prefix.size(), end - prefix.size());
+		return true;
+	}
+
+	// The first stage: read the input, handing on each deal as it's found
+	void read(std::istream& in, queue_t<record_t>& solve, writer_t& writer)
+	{
+		std::string line, value;
+		int lineno = 0, index = 0, board = 0;
+		bool pbn = false;
+		while (std::getline(in, line)) {
+			lineno++;
+			if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+			std::string::size_type start = line.find_first_not_of(" \t");
+			if (start == std::string::npos || line[start] == '%' || line[start] == ';') continue;
+			line = line.substr(start);
+
+			// PBN: a board number applies to the deal that follows it
+			if (line[0] == '[') {
+				pbn = true;
+				if (tag(line, "Board", value)) board = atoi(value.c_str());
+				if (!tag(line, "Deal", value)) continue;
+			} else {
+				if (pbn) continue;		// the play, auction and so on
+				value = line;
+				board = index + 1;
+			}
+
+			record_t r;
+			r.index = index++;
+			writer.admit(r.index);
+			r.valid = parse_deal(value, r.deal);
+			if (!r.valid) {
+				std::cerr << "Line " << lineno << ": can't read the deal" << std::endl;
+				writer.put(r);
+				continue;
+			}
+			r.deal.board = board;
+			solve.push(r);
+		}
+		solve.close();
+	}
+
+	// The middle stage, run on each thread of the pool: the double-dummy table (unless it's in the
+	// store already) and par
+	void solve_record(record_t& r, result_store_t* store)
+	{
+		if (!store || !lookup_result(store, &r.deal, &r.analysis)) {
+			analyze_deal(&r.deal, &r.analysis, 0);
+			if (store) store_result(store, &r.deal, &r.analysis);
+		}
+		analyze_par(r.deal.board, &r.analysis, &r.result);
+	}
+	void solve(queue_t<record_t>& in, writer_t& writer, result_store_t* store)
+	{
+		record_t r;
+		while (in.pop(r)) {
+			solve_record(r, store);
+			writer.put(r);
+		}
+	}
+
+	// The same for a binary deal file, taking the records a few at a time
+	const unsigned long chunk = 4;
+	void solve_corpus(const corpus_t* corpus, std::atomic<unsigned long>& taken, writer_t& writer, result_store_t* store)
+	{
+		const deal_record_t* deals = corpus_deals(corpus);
+		const unsigned long size = corpus_size(corpus);
+		for (unsigned long start = taken.fetch_add(chunk); start < size; start = taken.fetch_add(chunk)) {
+			for (unsigned long i = start; i < std::min(start + chunk, size); ++i) {
+				record_t r;
+				r.index = int(i);
+				writer.admit(r.index);
+				r.valid = unpack_deal(&deals[i], &r.deal);
+				if (r.valid) solve_record(r, store);
+				else std::cerr << "Record " << i << ": not a deal" << std::endl;
+				writer.put(r);
+			}
+		}
+	}
+}
+
+// Par analysis for every deal in a file of hand records ("-" for standard input), optionally written
+// to a binary result file, and looking in the store (if any) for deals that have been solved before
+void records(const std::string& filename, int threads, const std::string& output, result_store_t* store)
+{
+	FILE* binary = 0;
+	if (!output.empty()) {
+		binary = fopen(output.c_str(), "wb");
+		if (!binary || !write_corpus_header(binary, result_corpus)) {
+			std::cerr << "Can't write " << output << std::endl;
+			if (binary) fclose(binary);
+			return;
+		}
+	}
+	std::vector<std::thread> pool;
+
+	// Binary files are shared out between the threads directly
+	corpus_t* corpus = (filename != "-") ? open_corpus(filename.c_str()) : 0;
+	if (corpus && corpus_kind(corpus) == deal_corpus) {
+		writer_t writer(std::cout, binary, 4 * chunk * threads);
+		std::atomic<unsigned long> taken(0);
+		for (int i = 0; i < threads; ++i)
+			pool.push_back(std::thread(solve_corpus, corpus, std::ref(taken), std::ref(writer), store));
+		for (size_t i = 0; i < pool.size(); ++i)
+			pool[i].join();
+		close_corpus(corpus);
+		if (binary) fclose(binary);
+		return;
+	}
+	if (corpus) {
+		std::cerr << filename << " holds results, not deals" << std::endl;
+		close_corpus(corpus);
+		if (binary) fclose(binary);
+		return;
+	}
+
+	std::ifstream file;
+	if (filename != "-") {
+		file.open(filename.c_str());
+		if (!file) {
+			std::cerr << "Can't open " << filename << std::endl;
+			if (binary) fclose(binary);
+			return;
+		}
+	}
+	std::istream& in = (filename == "-") ? std::cin : file;
+
+	// Enough deals in hand to keep every thread busy, but no more
+	queue_t<record_t> queue(2 * threads);
+	writer_t writer(std::cout, binary, 8 * threads);
+	for (int i = 0; i < threads; ++i)
+		pool.push_back(std::thread(solve, std::ref(queue), std::ref(writer), store));
+	read(in, queue, writer);
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+	if (binary) fclose(binary);
+}
@@ -3,16 +3,197 @@
 
 #include "analyzer.h"
 #include "par.h"
+#include "dealer.h"
 #include <iostream>
-#include <mach/mach_time.h>
+#include <chrono>
+
+namespace {
+
+	int hcp(const deal_t& deal, player_t pl)
+	{
+		int total = 0;
+		for (card_t c = 0; c < 52; ++c)
+			if (deal.holder[c] == pl && rank(c) > 8) total += rank(c) - 8;
+		return total;
+	}
+
+	int length(const deal_t& deal, player_t pl, suit_t s)
+	{
+		int total = 0;
+		for (card_t c = s; c < 52; c += 4)
+			if (deal.holder[c] == pl) total++;
+		return total;
+	}
+
+	bool same_hands(const deal_t& a, const deal_t& b)
+	{
+		for (card_t c = 0; c < 52; ++c)
+			if (a.holder[c] != b.holder[c]) return false;
+		return true;
+	}
+
+	void report(const char* what, int failures)
+	{
+		std::cout << what << ": ";
+		if (failures) std::cout << failures << " FAILED" << std::endl;
+		else std::cout << "ok" << std::endl;
+	}
+
+	// Deals and splits come back from their numbers, and the numbers are in range
+	int test_numbering()
+	{
+		int failures = 0;
+		deal_constraints_t constraints;
+		no_constraints(&constraints);
+		dealer_t* dealer = new_dealer(&constraints, 1, 0);
+		deal_number_t total, n;
+		number_of_deals(&total);
+		deal_t deal, back;
+		for (int i = 0; i < 10000; ++i) {
+			next_deal(dealer, &deal);
+			rank_deal(&deal, &n);
+			if (n.high > total.high || (n.high == total.high && n.low >= total.low)) failures++;
+			if (!unrank_deal(&n, &back) || !same_hands(deal, back)) failures++;
+			const unsigned long split = rank_split(&deal);
+			back = deal;
+			unrank_split(&back, split);
+			if (split >= SPLITS || !same_hands(deal, back)) failures++;
+		}
+
+		// The first and last numbers, and one past the end
+		deal_number_t first = { 0, 0 }, last = total;
+		if (last.low-- == 0) last.high--;
+		if (!unrank_deal(&first, &deal)) failures++;
+		rank_deal(&deal, &n);
+		if (n.high != 0 || n.low != 0) failures++;
+		if (!unrank_deal(&last, &deal)) failures++;
+		rank_deal(&deal, &n);
+		if (n.high != last.high || n.low != last.low) failures++;
+		if (unrank_deal(&total, &deal)) failures++;
+
+		// Splits, spread over the whole range
+		next_deal(dealer, &deal);
+		for (unsigned long i = 0; i < SPLITS; i += 997) {
+			unrank_split(&deal, i);
+			if (rank_split(&deal) != i) failures++;
+		}
+		unrank_split(&deal, SPLITS - 1);
+		if (rank_split(&deal) != SPLITS - 1) failures++;
+		free_dealer(dealer);
+		return failures;
+	}
+
+	// Fixed cards stay put, every hand meets its constraints, and a seed gives the same deals again
+	int test_dealer()
+	{
+		int failures = 0;
+		deal_constraints_t constraints;
+		no_constraints(&constraints);
+		for (card_t c = sx; c < 52; c += 4) constraints.holder[c] = plN;
+		hand_constraint_t& south = constraints.hand[plS];
+		south.min_hcp = 15;
+		south.max_hcp = 17;
+		for (int s = cx; s < sx; ++s) {
+			south.min_length[s] = 2;
+			south.max_length[s] = 5;
+		}
+		dealer_t* dealer = new_dealer(&constraints, 7, 3);
+		dealer_t* again = new_dealer(&constraints, 7, 3);
+		deal_t deal, copy;
+		for (int i = 0; i < 10000; ++i) {
+			if (!next_deal(dealer, &deal) || !next_deal(again, &copy)) {
+				failures++;
+				break;
+			}
+			int count[5] = { 0, 0, 0, 0, 0 };
+			for (card_t c = 0; c < 52; ++c) {
+				count[deal.holder[c]]++;
+				if (constraints.holder[c] != plNone && deal.holder[c] != constraints.holder[c]) failures++;
+			}
+			if (count[plN] != 13 || count[plE] != 13 || count[plS] != 13 || count[plW] != 13) failures++;
+			if (hcp(deal, plS) < 15 || hcp(deal, plS) > 17) failures++;
+			for (int s = cx; s < sx; ++s)
+				if (length(deal, plS, suit_t(s)) < 2 || length(deal, plS, suit_t(s)) > 5) failures++;
+			if (!same_hands(deal, copy)) failures++;
+		}
+		free_dealer(dealer);
+		free_dealer(again);
+
+		// Impossible constraints are given up on
+		no_constraints(&constraints);
+		constraints.hand[plE].min_hcp = 38;
+		dealer = new_dealer(&constraints, 1, 0);
+		if (next_deal(dealer, &deal)) failures++;
+		free_dealer(dealer);
+		return failures;
+	}
+
+	// Scores for some contracts that make and some that go off
+	int test_scores()
+	{
+		const struct { suit_t trumps; int level, tricks, vulnerable, doubled, score; } cases[] = {
+			{ sx, 4, 10, 0, 0, 420 }, { nt, 3, 10, 1, 0, 630 }, { nt, 7, 13, 1, 0, 2220 },
+			{ cx, 1, 13, 0, 0, 190 }, { dx, 6, 12, 0, 0, 920 }, { sx, 2, 8, 0, 0, 110 },
+			{ hx, 4, 8, 0, 0, -100 }, { hx, 4, 7, 1, 1, -800 }, { nt, 3, 5, 0, 1, -800 }
+		};
+		int failures = 0;
+		for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+			if (contract_score(cases[i].trumps, cases[i].level, cases[i].tricks, cases[i].vulnerable, cases[i].doubled) != cases[i].score)
+				failures++;
+		return failures;
+	}
+
+	// Each annotation agrees with solving the position before the card on its own
+	int test_annotation()
+	{
+		int failures = 0;
+		for (int hand = 0; hand < 3; ++hand) {
+			deal_t deal;
+			randomdeal(&deal);
+			deal.declarer = plS;
+			deal.trumps = suit_t(hand);
+
+			// The lowest card that can be played, each time, which is often not the best
+			play_t play;
+			play.nCardsPlayed = 0;
+			while (play.nCardsPlayed < 20) {
+				dealstate_t state;
+				dealstate(&deal, &play, &state, true);
+				card_t c = 0;
+				while (state.cardstate[c] != playable) ++c;
+				play.played[play.nCardsPlayed++] = c;
+			}
+
+			play_annotation_t notes[52];
+			cache_t* cache = new_cache();
+			if (annotate_play(&deal, &play, cache, notes) != play.nCardsPlayed) failures++;
+			const partnership_t side = partnership(deal.declarer);
+			for (int i = 0; i <= play.nCardsPlayed; ++i) {
+				play_t prefix = play;
+				prefix.nCardsPlayed = i;
+				dealstate_t state;
+				dealstate(&deal, &prefix, &state, true);
+				const int left = 13 - i/4;
+				position_analysis_t pos;
+				pos.global.low = 0;
+				pos.global.high = 1 + left;
+				for (int c = 0; c < 52; ++c) pos.play[c] = pos.global;
+				pos.context = 0;
+				clear_cache(cache);
+				analyze(&deal, &prefix, cache, 0, &pos, best_only);
+				const int tricks = state.trickswon[side] + ((partnership(state.pl) == side) ? pos.global.low : left - pos.global.low);
+				if (tricks != ((i < play.nCardsPlayed) ? notes[i].before : notes[i-1].after)) failures++;
+			}
+			free_cache(cache);
+		}
+		return failures;
+	}
+}
 
 // Analysis for hand records
 void test_main()
 {
 	// Initialise data structures
-	play_t play;	
-	play.nCardsPlayed = 0;
-	position_analysis_t pos;
     deal_t deal;
     randomdeal(&deal);
     randomdeal(&deal);
@@ -21,29 +202,20 @@ void test_main()
     // Run the tests
     for (int i = 0; i < 10; ++i) 
     {
-        const uint64_t startTime = mach_absolute_time();
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         deal_analysis_t analysis;
         randomdeal(&deal);
-        for (int s = 0; s <= 4; s++) {
-            cache_t* cache = new_cache();
-            deal.trumps = suit_t(s);
-            for (int pl = 0; pl < 4; pl++) {
-                deal.declarer = player_t(pl);
-                pos.global.low = 0;
-                pos.global.high = 1 + 13;
-                pos.context = &(analysis.tricks[pl][s]);
-                analyze(&deal, &play, cache, 0, &pos, false);
-                analysis.tricks[pl][s] = 13-pos.global.low;
+        analyze_deal(&deal, &analysis, 0);
+        for (int s = 0; s <= 4; s++)
+            for (int pl = 0; pl < 4; pl++)
                 std::cout << "0123456789abcd"[analysis.tricks[pl][s]];
-            }
-            free_cache(cache);
-        }
-        const uint64_t endTime = mach_absolute_time();
-        const uint64_t elapsedMTU = endTime - startTime;            
-        mach_timebase_info_data_t info;
-        mach_timebase_info(&info);
-        const double elapsedNS = (double)elapsedMTU * (double)info.numer / (double)info.denom;            
-        std::cout << ' ' << elapsedNS/1000/1000/1000 << std::endl;
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << ' ' << elapsed.count() << std::endl;
     }
-}
 
+    // The simulation tools
+    report("Annotation", test_annotation());
+    report("Dealer", test_dealer());
+    report("Deal numbering", test_numbering());
+    report("Scores", test_scores());
+}
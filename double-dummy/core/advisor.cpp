@@ -0,0 +1,218 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Implementation of single-dummy advice
+//
+
+#include "advisor.h"
+#include "analyzer.h"
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	// What the play so far tells everyone at the table
+	struct history_t {
+		bool consistent;
+		player_t next;
+		player_t holder[52];			// declarer's and dummy's cards, and the cards the defenders have played
+		bool shown_out[4][4];			// [player][suit]
+
+		history_t(const deal_t& deal, const play_t& play) : consistent(true), next(nextpl(deal.declarer)) {
+			const partnership_t side = partnership(deal.declarer);
+			for (card_t c = 0; c < 52; ++c)
+				holder[c] = (deal.holder[c] < plNone && partnership(deal.holder[c]) == side) ? deal.holder[c] : plNone;
+			for (int pl = 0; pl < 4; ++pl)
+				for (int s = 0; s < 4; ++s)
+					shown_out[pl][s] = false;
+
+			bool played[52];
+			for (card_t c = 0; c < 52; ++c) played[c] = false;
+			card_t trick[4];
+			player_t leader = next;
+			for (int i = 0; i < play.nCardsPlayed && consistent; ++i) {
+				const card_t c = play.played[i];
+				if (c < 0 || c >= 52 || played[c]) { consistent = false; break; }
+				const int n = i % 4;
+				const suit_t led = (n > 0) ? suit(trick[0]) : suit(c);
+				if (partnership(next) == side) {
+					// Declarer and dummy: it must be in the hand, and follow suit if it can
+					if (holder[c] != next) { consistent = false; break; }
+					if (suit(c) != led)
+						for (card_t d = led; d < 52; d += 4)
+							if (holder[d] == next && !played[d]) consistent = false;
+				} else {
+					// A defender: it can't be one of ours, or in a suit they've shown out of
+					if (holder[c] != plNone || shown_out[next][suit(c)]) { consistent = false; break; }
+					holder[c] = next;
+					if (suit(c) != led) shown_out[next][led] = true;
+				}
+				played[c] = true;
+				trick[n] = c;
+				if (n == 0) leader = next;
+				if (n < 3) {
+					next = nextpl(next);
+					continue;
+				}
+
+				// The trick is over; the winner leads
+				int best = 0;
+				for (int k = 1; k < 4; ++k) {
+					const bool trumps = suit(trick[k]) == deal.trumps, besttrumps = suit(trick[best]) == deal.trumps;
+					if ((trumps && !besttrumps) || (suit(trick[k]) == suit(trick[best]) && rank(trick[k]) > rank(trick[best])))
+						best = k;
+				}
+				next = player_t((leader + best) % 4);
+			}
+			if (!consistent) next = plNone;
+		}
+	};
+}
+
+struct advisor_t {
+	deal_t deal;
+	play_t play;
+	deal_constraints_t constraints;
+	unsigned long long seed;
+
+	// Stopping; set and read atomically
+	int cancel;
+	limit_t limit;
+
+	// The totals so far, guarded by the mutex
+	std::mutex mutex;
+	std::condition_variable changed;
+	unsigned long samples;
+	unsigned long count[52];
+	double total[52];
+	bool failed;						// no deals could be found
+
+	std::vector<std::thread> threads;
+};
+
+namespace {
+
+	// The body of each thread: deal, solve, add it in
+	void sample(advisor_t* a, int stream)
+	{
+		dealer_t* dealer = new_dealer(&a->constraints, a->seed, stream);
+		cache_t* cache = new_cache();
+		deal_t d = a->deal;
+		while (!__atomic_load_n(&a->cancel, __ATOMIC_RELAXED)) {
+			if (!next_deal(dealer, &d)) {
+				std::lock_guard<std::mutex> lock(a->mutex);
+				a->failed = true;
+				a->changed.notify_all();
+				break;
+			}
+			position_analysis_t pos;
+			pos.global.low = 0;
+			pos.global.high = 1 + 13 - a->play.nCardsPlayed / 4;
+			for (int i = 0; i < 52; ++i)
+				pos.play[i] = pos.global;
+			pos.context = 0;
+			clear_cache(cache);
+			if (!analyze_limited(&d, &a->play, cache, 0, &pos, all_moves, &a->limit)) break;
+
+			dealstate_t state;
+			dealstate(&d, &a->play, &state, true);
+			std::lock_guard<std::mutex> lock(a->mutex);
+			a->samples++;
+			for (card_t c = 0; c < 52; ++c) {
+				if (state.cardstate[c] != playable) continue;
+				a->count[c]++;
+				a->total[c] += pos.play[c].low;
+			}
+			a->changed.notify_all();
+		}
+		free_cache(cache);
+		free_dealer(dealer);
+	}
+}
+
+player_t next_to_play(const deal_t* deal, const play_t* play)
+{
+	return history_t(*deal, *play).next;
+}
+
+int could_play(const deal_t* deal, const play_t* play, card_t c)
+{
+	if (play->nCardsPlayed >= 52) return 0;
+	play_t after = *play;
+	after.played[after.nCardsPlayed++] = c;
+	return history_t(*deal, after).consistent ? 1 : 0;
+}
+
+// Start sampling
+advisor_t* start_advice(const deal_t* deal, const play_t* play, const deal_constraints_t* constraints, unsigned long long seed, int nthreads)
+{
+	const history_t history(*deal, *play);
+	if (!history.consistent) return 0;
+
+	// Everything known is fixed; a defender who has shown out of a suit leaves the rest of it to partner
+	deal_constraints_t fixed;
+	if (constraints) fixed = *constraints;
+	else no_constraints(&fixed);
+	for (card_t c = 0; c < 52; ++c)
+		fixed.holder[c] = history.holder[c];
+	const player_t lho = nextpl(deal->declarer), rho = partner(lho);
+	for (card_t c = 0; c < 52; ++c) {
+		if (fixed.holder[c] != plNone) continue;
+		const bool left = history.shown_out[lho][suit(c)], right = history.shown_out[rho][suit(c)];
+		if (left && right) return 0;
+		if (left) fixed.holder[c] = rho;
+		if (right) fixed.holder[c] = lho;
+	}
+
+	advisor_t* a = new advisor_t;
+	a->deal = *deal;
+	a->play = *play;
+	a->constraints = fixed;
+	a->seed = seed;
+	a->cancel = 0;
+	a->limit.nodes = 0;
+	a->limit.milliseconds = 0;
+	a->limit.cancel = &a->cancel;
+	a->samples = 0;
+	for (card_t c = 0; c < 52; ++c) {
+		a->count[c] = 0;
+		a->total[c] = 0;
+	}
+	a->failed = false;
+	for (int i = 0; i < nthreads; ++i)
+		a->threads.push_back(std::thread(sample, a, i));
+	return a;
+}
+
+void poll_advice(advisor_t* a, advice_t* advice)
+{
+	std::lock_guard<std::mutex> lock(a->mutex);
+	advice->samples = a->samples;
+	for (card_t c = 0; c < 52; ++c) {
+		advice->count[c] = a->count[c];
+		advice->tricks[c] = a->count[c] ? a->total[c] / a->count[c] : 0;
+	}
+}
+
+int wait_advice(advisor_t* a, unsigned long samples, int milliseconds)
+{
+	std::unique_lock<std::mutex> lock(a->mutex);
+	if (milliseconds < 0)
+		a->changed.wait(lock, [a, samples] { return a->samples >= samples || a->failed; });
+	else
+		a->changed.wait_for(lock, std::chrono::milliseconds(milliseconds), [a, samples] { return a->samples >= samples || a->failed; });
+	if (a->samples >= samples) return 1;
+	return a->failed ? -1 : 0;
+}
+
+void free_advice(advisor_t* a)
+{
+	__atomic_store_n(&a->cancel, 1, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < a->threads.size(); ++i)
+		a->threads[i].join();
+	delete a;
+}
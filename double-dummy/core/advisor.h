@@ -0,0 +1,55 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Single-dummy advice: only declarer's and dummy's hands are known, so the defenders' are dealt at
+//  random, consistently with what they've played so far, and each sample solved double-dummy
+//
+
+#pragma once
+
+#include "types.h"
+#include "dealer.h"
+
+// What the samples say about the plays from the current position
+typedef struct advice_t {
+	unsigned long samples;			// solved so far
+	unsigned long count[52];		// samples in which the card could be played
+	double tricks[52];				// and the average tricks for the side to play after it (including any trick in progress)
+} advice_t;
+
+// Sampling and solving, in the background
+struct advisor_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The player to play next, working from the play alone. Returns plNone if the play isn't consistent
+// with declarer's and dummy's hands, or with the suits each defender has shown out of.
+player_t next_to_play(const deal_t*, const play_t*);
+
+// Can the card be played next, as far as anyone at the table can tell? Returns 1 if so.
+int could_play(const deal_t*, const play_t*, card_t);
+
+// Starts dealing the defenders' cards and solving each deal from the position, on the given number of
+// threads, until the advice is freed. The deal gives declarer's and dummy's hands (the rest of its
+// holders are ignored), declarer and trumps. The cards each defender has played are theirs, and a
+// defender who didn't follow suit gets no more cards of that suit; beyond that the constraints (which
+// may be null) apply. Returns null if the play isn't consistent.
+struct advisor_t* start_advice(const deal_t*, const play_t*, const deal_constraints_t*, unsigned long long seed, int nthreads);
+
+// Copies out the advice so far
+void poll_advice(struct advisor_t*, advice_t*);
+
+// Waits until at least the given number of samples have been solved, for at most the given time
+// (or indefinitely if negative). Returns 1 if they have, 0 on timeout, or -1 if no deals can be found
+// (and so no more samples will come).
+int wait_advice(struct advisor_t*, unsigned long samples, int milliseconds);
+
+// Stops promptly, and frees the advice
+void free_advice(struct advisor_t*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,6 +24,51 @@ typedef struct position_analysis_t {
 // Data returned to caller
 typedef int (*callback_t)(struct position_analysis_t*);
 
+// A question for probe_tricks: can the goal be made? Returns 1 if so, 0 if not, or -1 to give up
+typedef int (*probe_t)(int goal, void* context);
+
+// A yes/no question about a position, for answering in a batch
+typedef struct target_t {
+	const deal_t* deal;
+	const play_t* play;
+	partnership_t who;
+	int tricks;
+	int result;						// the answer, as for can_make
+} target_t;
+
+// The double-dummy result either side of a card in a play record
+typedef struct play_annotation_t {
+	int before;						// tricks for declarer's side in all (won so far and to come) before the card
+	int after;						// and after it
+	int cost;						// tricks the card cost the side that played it
+} play_annotation_t;
+
+// How much to find out about the individual moves, beyond the best result available
+typedef enum move_analysis_t {
+	best_only,						// nothing
+	all_moves,						// the exact result for every move
+	optimal_moves					// just which moves achieve the best result (one search per move)
+} move_analysis_t;
+
+// Limits on the work done by a single analysis; zero (or null) fields are unlimited
+typedef struct limit_t {
+	unsigned long nodes;			// maximum number of search nodes to visit
+	int milliseconds;				// maximum elapsed time
+	const int* cancel;				// analysis stops as soon as this becomes non-zero; set it with __atomic_store_n
+} limit_t;
+
+// Which results the cache keeps. Results found with only a few tricks left are usually cheap to find
+// again, so a cache short of memory can drop them unless they took many nodes to find. By default
+// everything is kept.
+// A thread's own cache in front of a shared one keeps results with only a few tricks left to itself, and
+// passes the rest on to the shared cache; it's cleared when it grows past its limit.
+typedef struct cache_config_t {
+	int shallow_tricks;				// results with this many tricks left or fewer are shallow
+	unsigned long shallow_nodes;	// the nodes a shallow result must have taken to be kept
+	int local_tricks;				// results with this many tricks left or fewer aren't shared
+	unsigned long local_entries;	// the most results a thread's own cache holds
+} cache_config_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,14 +79,57 @@ struct cache_t* new_cache();
 void free_cache(struct cache_t*);
 void clear_cache(struct cache_t*);
 struct cache_t* clone_cache(struct cache_t*);
+void default_cache_config(cache_config_t*);
+void configure_cache(struct cache_t*, const cache_config_t*);
+unsigned long cache_entries(const struct cache_t*);
+
+// Cache shared between threads working on the same deal and trump suit. It uses the given cache in place
+// as its table, which must be left alone until the shared cache has been freed. Each thread gets a cache
+// of its own that looks there first, and then (under a lock) in the table.
+struct shared_cache_t;
+struct shared_cache_t* new_shared_cache(struct cache_t*);
+void free_shared_cache(struct shared_cache_t*);
+struct cache_t* new_local_cache(struct shared_cache_t*);
     
 // Get the current state of play
 void dealstate(const deal_t*, const play_t*, dealstate_t*, int quitted);
 
-// Perform analysis
-void analyze(const deal_t*, const play_t*, struct cache_t*, const callback_t, position_analysis_t*, bool analyze_moves);
+// Perform analysis. Returns 1 if the analysis ran to completion, or 0 if it was stopped early (by the
+// callback or a limit), in which case the bounds hold the best results proven so far
+int analyze(const deal_t*, const play_t*, struct cache_t*, const callback_t, position_analysis_t*, move_analysis_t analyze_moves);
+int analyze_limited(const deal_t*, const play_t*, struct cache_t*, const callback_t, position_analysis_t*, move_analysis_t analyze_moves, const limit_t*);
+
+// Can the side take at least the given number of the remaining tricks (including any trick in progress)?
+// This takes a single search. Returns 1 if so, 0 if not, or -1 if the limit (which may be null) was reached.
+int can_make(const deal_t*, const play_t*, struct cache_t*, partnership_t who, int tricks, const limit_t*);
+
+// Answers each question in turn, with the limit applying to each. Consecutive questions about the same
+// deal and trump suit share the cache; it's cleared whenever that changes. What the cache holds to begin
+// with is kept, so it must be empty or belong to the first question's deal and trump suit.
+void can_make_batch(target_t*, int count, struct cache_t*, const limit_t*);
+
+// Follows the best play from the position to the end of the hand, relying on what the cache already knows
+// and searching only where it has to, so that after an analysis it costs little more. Returns the number
+// of tricks for the side to play (including any trick in progress). Should no card keep to that result,
+// the line stops short there.
+int optimal_line(const deal_t*, const play_t*, struct cache_t*, play_t* line);
+
+// Works out what each card of the play record did to the double-dummy result. The positions are solved
+// from the last back to the first, so that each solve finds the cache warmed up by the ones after it.
+// Returns the number of cards annotated, which stops short at the first illegal play.
+int annotate_play(const deal_t*, const play_t*, struct cache_t*, play_annotation_t*);
+
+// Pins down a result within the window (high > n >= low) one single-target question at a time, probing
+// outwards from the guess and taking bigger steps while it keeps turning out wrong in the same direction.
+// The window narrows as the answers come in. Returns 1 once it's down to the result, or 0 if the probe
+// gave up, in which case the window holds what was proven so far.
+int probe_tricks(bound_t* window, int guess, probe_t make, void* context);
+
+// A quick guess (from the cards alone, without searching) at how many of the remaining tricks the side
+// will take. It takes about a microsecond and is usually within a trick; analyze() starts from it.
+int estimate_tricks(const deal_t*, const play_t*, partnership_t who);
 
-// Generate a random deal
+// Generate a random deal, with rand(); for simulations, see dealer.h
 void randomdeal(deal_t*);
 
 #ifdef __cplusplus
@@ -0,0 +1,260 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Implementation of background analysis
+//
+
+#include "async.h"
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+struct analysis_job_t {
+	// What to analyze
+	deal_t deal;
+	play_t play;
+	cache_t* cache;
+	move_analysis_t analyze_moves;
+	int context;
+
+	// Stopping early; set and read atomically
+	int cancel;
+	limit_t limit;
+
+	// The latest results, guarded by the mutex
+	std::mutex mutex;
+	std::condition_variable changed;
+	position_analysis_t latest;
+	void* callercontext;		// the context field of the caller's position analysis
+	int version;				// bumped whenever there is something new
+	int seen;					// the version the caller last polled
+	bool finished;
+
+	// Completion of the worker; returns whether the analysis ran to completion
+	std::future<int> done;
+};
+
+struct ponder_t {
+	// Where we're pondering from
+	deal_t deal;
+	play_t play;
+	cache_t* cache;
+	shared_cache_t* shared;		// the cache, shared between the threads if there's more than one
+	int tricksleft;				// after the next play
+
+	// Stopping; set and read atomically
+	int cancel;
+	limit_t limit;
+
+	// The plays to look at, and what we've found; guarded by the mutex
+	std::mutex mutex;
+	card_t order[13];
+	int count;
+	int next;
+	int state[52];				// -1: no results yet, 0: interrupted, 1: complete
+	position_analysis_t results[52];
+
+	std::vector<std::thread> threads;
+};
+
+namespace {
+
+	// Makes new results available to the caller
+	void publish(analysis_job_t* job, const position_analysis_t& pos, bool finished)
+	{
+		std::lock_guard<std::mutex> lock(job->mutex);
+		job->latest = pos;
+		job->latest.context = job->callercontext;
+		job->finished = finished;
+		job->version++;
+		job->changed.notify_all();
+	}
+
+	// Called by the analyzer whenever it improves a bound
+	int progress(position_analysis_t* pos)
+	{
+		analysis_job_t* job = (analysis_job_t*)pos->context;
+		publish(job, *pos, false);
+		return !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED);
+	}
+
+	// The body of the worker thread
+	int run(analysis_job_t* job)
+	{
+		position_analysis_t pos = job->latest;
+		pos.context = job;
+		int rv = analyze_limited(&job->deal, &job->play, job->cache, progress, &pos, job->analyze_moves, &job->limit);
+		publish(job, pos, true);
+		return rv;
+	}
+}
+
+namespace {
+
+	// Orders plays by how promising they look: best first, then by the bounds found so far
+	struct more_promising {
+		const position_analysis_t* pos;
+		more_promising(const position_analysis_t* pos) : pos(pos) { }
+		bool operator()(card_t a, card_t b) const {
+			if (pos->play[a].low != pos->play[b].low) return pos->play[a].low > pos->play[b].low;
+			return pos->play[a].high > pos->play[b].high;
+		}
+	};
+
+	// The body of each pondering thread; takes the next play to look at until there are none left
+	void ponder(ponder_t* p, cache_t* cache)
+	{
+		while (!__atomic_load_n(&p->cancel, __ATOMIC_RELAXED)) {
+			card_t c;
+			{
+				std::lock_guard<std::mutex> lock(p->mutex);
+				if (p->next == p->count) break;
+				c = p->order[p->next++];
+			}
+			play_t play = p->play;
+			play.played[play.nCardsPlayed++] = c;
+			position_analysis_t pos;
+			pos.global.low = 0;
+			pos.global.high = 1 + p->tricksleft;
+			for (int i = 0; i < 52; ++i)
+				pos.play[i] = pos.global;
+			pos.context = 0;
+			int complete = analyze_limited(&p->deal, &play, cache, 0, &pos, optimal_moves, &p->limit);
+			std::lock_guard<std::mutex> lock(p->mutex);
+			p->results[c] = pos;
+			p->state[c] = complete;
+		}
+		if (cache != p->cache) free_cache(cache);
+	}
+}
+
+// Start looking at the positions after each play
+ponder_t* start_pondering(const deal_t* deal, const play_t* play, cache_t* cache, const position_analysis_t* pos, int nthreads)
+{
+	ponder_t* p = new ponder_t;
+	p->deal = *deal;
+	p->play = *play;
+	p->cache = cache;
+	p->shared = 0;
+	int ndealt = 0;
+	for (int c = 0; c < 52; ++c)
+		if (deal->holder[c] != plNone) ndealt++;
+	p->tricksleft = ndealt/4 - (play->nCardsPlayed+1)/4;
+	p->cancel = 0;
+	p->limit.nodes = 0;
+	p->limit.milliseconds = 0;
+	p->limit.cancel = &p->cancel;
+
+	// Most promising plays first
+	dealstate_t state;
+	dealstate(deal, play, &state, true);
+	p->count = 0;
+	p->next = 0;
+	for (int c = 0; c < 52; ++c) {
+		p->state[c] = -1;
+		if (state.cardstate[c] == playable) p->order[p->count++] = c;
+	}
+	std::stable_sort(p->order, p->order + p->count, more_promising(pos));
+
+	// Off we go. A single thread uses the cache directly; otherwise each has its own in front of the shared one.
+	if (nthreads <= 1) {
+		p->threads.push_back(std::thread(ponder, p, cache));
+		return p;
+	}
+	p->shared = new_shared_cache(cache);
+	for (int i = 0; i < nthreads; ++i)
+		p->threads.push_back(std::thread(ponder, p, new_local_cache(p->shared)));
+	return p;
+}
+
+// What we've found out about the position after a play
+int ponder_result(ponder_t* p, card_t c, position_analysis_t* pos)
+{
+	std::lock_guard<std::mutex> lock(p->mutex);
+	if (p->state[c] < 0) return -1;
+	*pos = p->results[c];
+	return p->state[c];
+}
+
+// Stop all the threads
+void stop_pondering(ponder_t* p)
+{
+	__atomic_store_n(&p->cancel, 1, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < p->threads.size(); ++i)
+		if (p->threads[i].joinable()) p->threads[i].join();
+}
+
+// Stop and tidy up
+void free_pondering(ponder_t* p)
+{
+	stop_pondering(p);
+	if (p->shared) free_shared_cache(p->shared);
+	delete p;
+}
+
+// Start analysing on a background thread
+analysis_job_t* start_analysis(const deal_t* deal, const play_t* play, cache_t* cache, const position_analysis_t* pos, move_analysis_t analyze_moves, int context)
+{
+	analysis_job_t* job = new analysis_job_t;
+	job->deal = *deal;
+	job->play = *play;
+	job->cache = cache;
+	job->analyze_moves = analyze_moves;
+	job->context = context;
+	job->cancel = 0;
+	job->limit.nodes = 0;
+	job->limit.milliseconds = 0;
+	job->limit.cancel = &job->cancel;
+	job->latest = *pos;
+	job->callercontext = pos->context;
+	job->version = 0;
+	job->seen = 0;
+	job->finished = false;
+	job->done = std::async(std::launch::async, run, job);
+	return job;
+}
+
+// Copy out the latest results
+int poll_analysis(analysis_job_t* job, position_analysis_t* pos)
+{
+	std::lock_guard<std::mutex> lock(job->mutex);
+	*pos = job->latest;
+	job->seen = job->version;
+	return job->finished;
+}
+
+// Wait for something new
+int wait_analysis(analysis_job_t* job, int milliseconds)
+{
+	std::unique_lock<std::mutex> lock(job->mutex);
+	if (milliseconds < 0) {
+		job->changed.wait(lock, [job] { return job->version != job->seen; });
+		return 1;
+	}
+	return job->changed.wait_for(lock, std::chrono::milliseconds(milliseconds), [job] { return job->version != job->seen; });
+}
+
+// Ask the worker to stop
+void cancel_analysis(analysis_job_t* job)
+{
+	__atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+}
+
+// The caller's context
+int analysis_context(const analysis_job_t* job)
+{
+	return job->context;
+}
+
+// Stop the worker and tidy up
+void free_analysis(analysis_job_t* job)
+{
+	cancel_analysis(job);
+	job->done.wait();
+	delete job;
+}
@@ -0,0 +1,62 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Running analysis in the background, so that the caller can get on with other things
+//
+
+#pragma once
+
+#include "types.h"
+#include "analyzer.h"
+
+// A single analysis running on a background thread
+struct analysis_job_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts analysing the position on a background thread. The deal, play and starting bounds are copied,
+// but the cache is used in place and must be left alone until the job has been freed. The context
+// is handed back with the results, so that the caller can tell whether they are still wanted.
+struct analysis_job_t* start_analysis(const deal_t*, const play_t*, struct cache_t*, const position_analysis_t*, move_analysis_t analyze_moves, int context);
+
+// Copies out the best bounds proven so far. Returns 1 if the analysis has finished, 0 otherwise.
+int poll_analysis(struct analysis_job_t*, position_analysis_t*);
+
+// Waits until there is something the caller hasn't yet polled (new bounds, or the analysis finishing),
+// for at most the given time (or indefinitely if negative). Returns 1 if there is, 0 on timeout.
+int wait_analysis(struct analysis_job_t*, int milliseconds);
+
+// Asks the analysis to stop; it will do so promptly, keeping whatever it has proven
+void cancel_analysis(struct analysis_job_t*);
+
+// The context given when the job was started
+int analysis_context(const struct analysis_job_t*);
+
+// Cancels the analysis if it's still running, waits for the worker to stop, and frees the job
+void free_analysis(struct analysis_job_t*);
+
+// Speculative analysis of the positions after each of the plays available from a position
+struct ponder_t;
+
+// Starts analysing the positions reached by each legal play from the given position, most promising plays
+// first (as judged by the position analysis), on the given number of threads. Each position is analysed far
+// enough to know which of its moves are optimal. The cache is used in place; with more than one thread,
+// each has a small cache of its own in front of it, and only the positions with more tricks left are shared.
+struct ponder_t* start_pondering(const deal_t*, const play_t*, struct cache_t*, const position_analysis_t*, int nthreads);
+
+// Copies out the analysis of the position after playing the given card. Returns 1 if the analysis is complete,
+// 0 if it was interrupted (in which case the bounds are those proven so far), or -1 if there's nothing yet.
+int ponder_result(struct ponder_t*, card_t, position_analysis_t*);
+
+// Stops pondering promptly. Once this returns the cache can be used again, and the results are final.
+void stop_pondering(struct ponder_t*);
+
+// Stops pondering if necessary, and frees it
+void free_pondering(struct ponder_t*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -177,6 +177,73 @@ namespace {
         change.annotation_action = none;
         add_change(p, change);
     }
+
+    void unquit_trick(card_changes_t* p, card_t c, player_t pl, int trick)
+    {
+        card_change_t change;
+        change.card = c;
+        change.move = true;
+        change.from = loc_played(pl, trick);
+        change.to = loc_ontable(pl);
+        change.annotation_action = none;
+        add_change(p, change);
+    }
+
+    // Takes the annotations off the cards that can currently be played
+    void remove_annotations(controller_info_t* info, card_changes_t* changes)
+    {
+        for (int i = 0; i < 52; ++i) {
+            if (info->cardstate[i].state == playable) {
+                card_change_t change;
+                change.card = i;
+                change.move = false;
+                change.from = info->cardstate[i].location;
+                change.to = info->cardstate[i].location;
+                change.annotation_action = remove_annotation;
+                change.annotation = annotation_unplayable();
+                add_change(changes, change);
+            }
+        }
+    }
+
+    // Converts the bound for a play (tricks for the side that played the card, counting the trick it was
+    // played to) into a bound for the position after it (tricks for the side now to play)
+    bound_t bound_after_play(bound_t play_bound, bool sameside, int tricksleft)
+    {
+        bound_t rv;
+        if (sameside) {
+            // We must just have won the trick
+            rv.low = play_bound.low-1;
+            rv.high = play_bound.high-1;
+        } else {
+            rv.low = tricksleft+1 - play_bound.high;
+            rv.high = tricksleft+1 - play_bound.low;
+        }
+        if (rv.low < 0) rv.low = 0;
+        if (rv.high > tricksleft+1) rv.high = tricksleft+1;
+        return rv;
+    }
+
+    // Tightens a position analysis with another analysis of the same position
+    void merge_position_analysis(position_analysis_t* pos, const position_analysis_t* other)
+    {
+        if (pos->global.low < other->global.low) pos->global.low = other->global.low;
+        if (pos->global.high > other->global.high) pos->global.high = other->global.high;
+        for (int i = 0; i < 52; ++i) {
+            if (pos->play[i].low < other->play[i].low) pos->play[i].low = other->play[i].low;
+            if (pos->play[i].high > other->play[i].high) pos->play[i].high = other->play[i].high;
+        }
+    }
+
+    // Narrows a position analysis to lie within the given bound
+    void narrow_position_analysis(position_analysis_t* pos, bound_t bound)
+    {
+        if (pos->global.low < bound.low) pos->global.low = bound.low;
+        if (pos->global.high > bound.high) pos->global.high = bound.high;
+        for (int i = 0; i < 52; ++i) {
+            if (pos->play[i].high > pos->global.high) pos->play[i].high = pos->global.high;
+        }
+    }
 }
 
 // Initialise view (and position analysis) based on deal and play so far
@@ -195,6 +262,8 @@ void initialise_view(controller_info_t* info, bool no_play_yet)
             info->playcontext[i] = -1;
         }
         info->playcontext[0] = info->nextcontext++;
+        info->redo_upto = info->play.nCardsPlayed;
+        info->next_context = -1;
     }
 	
 	// No cards played yet
@@ -327,26 +396,47 @@ void update_for_analysis(controller_info_t* info, card_changes_t* changes)
     update_for_analysis_ex(info, changes);
 }
 
+// Stores results from a background analysis, if they're still relevant
+int update_for_background_analysis(controller_info_t* info, card_changes_t* changes, int nCardsPlayed, int context, const position_analysis_t* analysis)
+{
+    changes->num_changes = 0;
+    if (nCardsPlayed >= 52 || context < 0 || info->playcontext[nCardsPlayed] != context) return 1;
+    void* saved_context = info->analysis[nCardsPlayed].context;
+    info->analysis[nCardsPlayed] = *analysis;
+    info->analysis[nCardsPlayed].context = saved_context;
+    if (nCardsPlayed == info->play.nCardsPlayed)
+        update_for_analysis_ex(info, changes);
+    return 0;
+}
+
+// Stores a speculative analysis for a possible play
+void update_for_ponder(controller_info_t* info, card_t c, const position_analysis_t* analysis)
+{
+    const int n = info->play.nCardsPlayed;
+    if (info->next_context != info->playcontext[n]) {
+        for (int i = 0; i < 52; ++i)
+            info->has_next_analysis[i] = false;
+        info->next_context = info->playcontext[n];
+    }
+    info->next_analysis[c] = *analysis;
+    info->has_next_analysis[c] = true;
+}
+
 // Updates data structures for the play just made; returns 0 if the action is OK
 int update_for_play(controller_info_t* info, card_changes_t* changes, card_t c)
 {
     changes->num_changes = 0;
     if (info->cardstate[c].state != playable) return 1;
 
+    // Is this the play we'd got to before? If so, we can carry on using what we found out then
+    const int prev = info->play.nCardsPlayed;
+    const bool redo = (prev < info->redo_upto) && (info->play.played[prev] == c);
+    const bool pondered = (info->next_context == info->playcontext[prev]) && info->has_next_analysis[c];
+    info->next_context = -1;
+
     // Remove existing annotations
     player_t pl = info->deal.holder[c];
-    for (int i = 0; i < 52; ++i) {
-        if (info->cardstate[i].state == playable) {
-            card_change_t change;
-            change.card = i;
-            change.move = false;
-            change.from = info->cardstate[i].location;
-            change.to = info->cardstate[i].location;
-            change.annotation_action = remove_annotation;
-			change.annotation = annotation_unplayable();
-			add_change(changes, change);
-        }
-    }
+    remove_annotations(info, changes);
 
     // Move the card
     play_card(changes, pl, c, info->cardstate[c].location.index);
@@ -360,33 +450,33 @@ int update_for_play(controller_info_t* info, card_changes_t* changes, card_t c)
     
     // Update data structures for the play
     info->play.played[info->play.nCardsPlayed++] = c;
-    info->playcontext[info->play.nCardsPlayed] = info->nextcontext++;
+    const int n = info->play.nCardsPlayed;
+    if (!redo) {
+        info->redo_upto = n;
+        for (int i = n; i < 52; ++i)
+            info->playcontext[i] = -1;              // so that late results for the old line get discarded
+        if (n < 52) {
+            info->playcontext[n] = info->nextcontext++;
+            init_position_analysis(&info->analysis[n], 13 - n/4);
+        }
+    }
     initialise_view(info, false);
-	if (info->play.nCardsPlayed < 52)
-		init_position_analysis(&info->analysis[info->play.nCardsPlayed], 13 - info->play.nCardsPlayed/4);
     
     // If it's the end of the trick, quit it
-    const int n = info->play.nCardsPlayed;
     if (n % 4 == 0) {
         changes->pause_after = changes->num_changes - 1;
         for (int i = n-4; i < n; ++i)
             quit_trick(changes, info->play.played[i], info->deal.holder[info->play.played[i]], n/4-1);
     }
+    if (n == 52) return 0;
+
+    // Use anything we found out while pondering
+    if (pondered)
+        merge_position_analysis(&info->analysis[n], &info->next_analysis[c]);
     
     // Get next bound from the bound for this play
-    bound_t play_bound = info->analysis[info->play.nCardsPlayed-1].play[c];
-    if (partnership(pl) == partnership(info->nextpl)) {
-        info->analysis[info->play.nCardsPlayed].global.low = floor0(play_bound.low-1);
-        info->analysis[info->play.nCardsPlayed].global.high = floor0(play_bound.high-1);
-    } else {
-        int tricksleft = 13 - (info->play.nCardsPlayed-1)/4;
-        info->analysis[info->play.nCardsPlayed].global.high = tricksleft+1 - play_bound.low;
-        info->analysis[info->play.nCardsPlayed].global.low = tricksleft+1 - play_bound.high;
-    }
-    for (int i = 0; i < 52; ++i) {
-        info->analysis[info->play.nCardsPlayed].play[i].high = info->analysis[info->play.nCardsPlayed].global.high;
-        info->analysis[info->play.nCardsPlayed].play[i].low = 0;
-    }
+    const bool sameside = (partnership(pl) == partnership(info->nextpl));
+    narrow_position_analysis(&info->analysis[n], bound_after_play(info->analysis[prev].play[c], sameside, 13 - n/4));
         
 	// Add annotations
 	update_for_analysis_ex(info, changes);
@@ -398,25 +488,62 @@ int update_for_play(controller_info_t* info, card_changes_t* changes, card_t c)
 // at the first trick). 
 int update_for_undo(controller_info_t* info, card_changes_t* changes)
 {
-    // TODO
-    changes->num_changes = 0;
+    init_changes(changes);
+    const int n = info->play.nCardsPlayed;
+    if (n == 0) return 1;
+    const card_t c = info->play.played[n-1];
+    const player_t pl = info->deal.holder[c];
+    remove_annotations(info, changes);
+
+    // If the trick has been quitted, bring it back
+    if (n % 4 == 0) {
+        for (int i = n-4; i < n; ++i)
+            unquit_trick(changes, info->play.played[i], info->deal.holder[info->play.played[i]], n/4-1);
+    }
+
+    // Make a gap for the card in its owner's hand, and put it back
+    const player_view_t& view = info->view.pl_view[pl];
+    int index = 0;
+    while (index < 13 && view.hand[suit(c)][index].has_card && view.hand[suit(c)][index].card > c) ++index;
+    for (int i = 11; i >= index; --i) {
+        if (view.hand[suit(c)][i].has_card)
+            move_card_along(changes, view.hand[suit(c)][i].card, pl, i, i+1);
+    }
+    unplay_card(changes, pl, index, c, &info->analysis[n-1]);
+
+    // The earlier position's analysis has been kept, as has everything after it in case of a redo
+    info->play.nCardsPlayed--;
+    initialise_view(info, false);
+    update_for_analysis_ex(info, changes);
     return 0;
 }
 
 // Performs a redo. Returns 1 if not possible (perhaps because we've got to the end of the re-do stack). 
 int update_for_redo(controller_info_t* info, card_changes_t* changes)
 {
-    // TODO
-    changes->num_changes = 0;    
-    return 0;
+    init_changes(changes);
+    if (info->play.nCardsPlayed >= info->redo_upto) return 1;
+    return update_for_play(info, changes, info->play.played[info->play.nCardsPlayed]);
 }
 
 // Makes the default play 
 // Returns 1 if not possible (presumably because there are no cards left) 
 int update_for_forward(controller_info_t* info, card_changes_t* changes)
 {
-    // TODO
-    changes->num_changes = 0;
-    return 0;
-}
+    init_changes(changes);
+    const int n = info->play.nCardsPlayed;
+    if (n >= 52) return 1;
 
+    // Go with the best card we've found so far, whatever the redo stack holds; a proven best card will have
+    // the highest lower bound. If it's the card on the redo stack, the stack is kept.
+    const position_analysis_t& pos = info->analysis[n];
+    card_t best = -1;
+    for (int c = 51; c >= 0; --c) {
+        if (info->cardstate[c].state != playable) continue;
+        if (best < 0 || pos.play[c].low > pos.play[best].low ||
+            (pos.play[c].low == pos.play[best].low && pos.play[c].high > pos.play[best].high))
+            best = c;
+    }
+    if (best < 0) return 1;
+    return update_for_play(info, changes, best);
+}
@@ -87,6 +87,10 @@ typedef struct controller_info_t {
     play_t play; 
     int redo_upto;                                  // How far forward we can do a re-do 
     position_analysis_t analysis[52];               // Per play, to allow for better undo 
+    position_analysis_t next_analysis[52];          // Per card, of the position after playing it from the current
+                                                    // position; worked out speculatively while the user thinks
+    bool has_next_analysis[52];
+    int next_context;                               // The context of the position the speculative analyses follow
 } controller_info_t;
 
 #ifdef __cplusplus 
@@ -99,6 +103,15 @@ extern "C" {
     // Provides updates based on new analysis 
     void update_for_analysis(controller_info_t* info, card_changes_t* changes);
     
+    // Stores the results of a background analysis of the position after the given number of cards,
+    // provided the play leading to it hasn't changed since the analysis started (as identified by
+    // its context). Returns 0 if the results were stored, 1 if they were stale and discarded.
+    int update_for_background_analysis(controller_info_t* info, card_changes_t* changes, int nCardsPlayed, int context, const position_analysis_t* analysis);
+    
+    // Stores a speculative analysis of the position after playing the given card from the current
+    // position, to be used if that card does get played
+    void update_for_ponder(controller_info_t* info, card_t play, const position_analysis_t* analysis);
+    
     // Updates data structures for the play just made; returns 0 if the action is OK 
     // 1 if it is not (e.g. an invalid card, or backing up from the first trick) 
     int update_for_play(controller_info_t* info, card_changes_t* changes, card_t play);
@@ -110,7 +123,7 @@ extern "C" {
     // Performs a redo. Returns 1 if not possible (perhaps because we've got to the end of the re-do stack). 
     int update_for_redo(controller_info_t* info, card_changes_t* changes);
     
-    // Makes the default play 
+    // Makes the default play: the card with the best proven bound (use update_for_redo to replay the redo stack)
     // Returns 1 if not possible (presumably because there are no cards left) 
     int update_for_forward(controller_info_t* info, card_changes_t* changes);
     
@@ -0,0 +1,170 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Implementation of binary deal and result files
+//
+
+#include "corpus.h"
+#include <cstring>
+#include <cstdlib>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct corpus_t {
+	const unsigned char* data;		// the whole file
+	size_t length;
+	corpus_kind_t kind;
+	unsigned long size;				// number of records
+};
+
+namespace {
+
+	// The header: a magic string, the kind of record and the format version, padded to a record's width
+	const char magic[8] = { 'F', 'F', 'C', 'O', 'R', 'P', 'U', 'S' };
+	const int version = 1;
+	const size_t header_size = 16;
+	const size_t record_size = 16;
+
+	// Results are 0-13 tricks, so fit in a nibble
+	inline void put_nibble(unsigned char* bytes, int i, int v) { bytes[i/2] |= (v & 15) << (4*(i%2)); }
+	inline int get_nibble(const unsigned char* bytes, int i) { return (bytes[i/2] >> (4*(i%2))) & 15; }
+}
+
+// Deal: bytes 0-12 are the holders, 4 cards to a byte; 13-14 the board number; 15 declarer and trumps
+void pack_deal(const deal_t* deal, deal_record_t* rec)
+{
+	memset(rec->bytes, 0, sizeof(rec->bytes));
+	for (card_t c = 0; c < 52; ++c)
+		rec->bytes[c/4] |= (deal->holder[c] & 3) << (2*(c%4));
+	rec->bytes[13] = deal->board & 0xff;
+	rec->bytes[14] = (deal->board >> 8) & 0xff;
+	rec->bytes[15] = (deal->declarer & 3) | (deal->trumps << 2);
+}
+
+int unpack_deal(const deal_record_t* rec, deal_t* deal)
+{
+	int count[4] = {0, 0, 0, 0};
+	for (card_t c = 0; c < 52; ++c) {
+		deal->holder[c] = player_t((rec->bytes[c/4] >> (2*(c%4))) & 3);
+		count[deal->holder[c]]++;
+	}
+	deal->board = rec->bytes[13] | (rec->bytes[14] << 8);
+	deal->declarer = player_t(rec->bytes[15] & 3);
+	deal->trumps = suit_t((rec->bytes[15] >> 2) & 7);
+	return count[0] == 13 && count[1] == 13 && count[2] == 13 && deal->trumps <= nt;
+}
+
+// Result: bytes 0-9 the table; 10 the level and trumps; 11 declarer; 12 tricks; 13-14 the score
+void pack_result(const deal_analysis_t* analysis, const result_t* result, result_record_t* rec)
+{
+	memset(rec->bytes, 0, sizeof(rec->bytes));
+	for (int pl = 0; pl < 4; ++pl)
+		for (int s = 0; s <= 4; ++s)
+			put_nibble(rec->bytes, pl*5 + s, analysis->tricks[pl][s]);
+	rec->bytes[10] = result->level | (result->trumps << 4);
+	rec->bytes[11] = result->declarer;
+	rec->bytes[12] = result->tricks;
+	rec->bytes[13] = result->score & 0xff;
+	rec->bytes[14] = (result->score >> 8) & 0xff;
+}
+
+// No contract goes above the seven level, so a level of 15 marks the placeholder
+void pack_no_result(result_record_t* rec)
+{
+	memset(rec->bytes, 0, sizeof(rec->bytes));
+	rec->bytes[10] = 15;
+}
+
+int unpack_result(const result_record_t* rec, deal_analysis_t* analysis, result_t* result)
+{
+	if ((rec->bytes[10] & 15) > 7) return 0;
+	for (int pl = 0; pl < 4; ++pl)
+		for (int s = 0; s <= 4; ++s)
+			analysis->tricks[pl][s] = get_nibble(rec->bytes, pl*5 + s);
+	result->level = rec->bytes[10] & 15;
+	result->trumps = suit_t(rec->bytes[10] >> 4);
+	result->declarer = player_t(rec->bytes[11]);
+	result->tricks = rec->bytes[12];
+	result->score = short(rec->bytes[13] | (rec->bytes[14] << 8));
+	return 1;
+}
+
+// Start a file
+int write_corpus_header(FILE* f, corpus_kind_t kind)
+{
+	unsigned char header[header_size];
+	memset(header, 0, sizeof(header));
+	memcpy(header, magic, sizeof(magic));
+	header[8] = kind;
+	header[9] = version;
+	return fwrite(header, sizeof(header), 1, f) == 1;
+}
+
+// Map a file into memory
+corpus_t* open_corpus(const char* filename)
+{
+	corpus_t* corpus = new corpus_t;
+#ifndef WIN32
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) { delete corpus; return 0; }
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && size_t(st.st_size) >= header_size)
+		data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) { delete corpus; return 0; }
+	corpus->data = (const unsigned char*)data;
+	corpus->length = st.st_size;
+#else
+	// No mmap, so read it all in
+	FILE* f = fopen(filename, "rb");
+	if (!f) { delete corpus; return 0; }
+	fseek(f, 0, SEEK_END);
+	corpus->length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	unsigned char* data = (unsigned char*)malloc(corpus->length ? corpus->length : 1);
+	bool ok = fread(data, 1, corpus->length, f) == corpus->length && corpus->length >= header_size;
+	fclose(f);
+	corpus->data = data;
+	if (!ok) { close_corpus(corpus); return 0; }
+#endif
+	const unsigned char* header = corpus->data;
+	if (memcmp(header, magic, sizeof(magic)) != 0 || header[9] != version || header[8] > result_corpus) {
+		close_corpus(corpus);
+		return 0;
+	}
+	corpus->kind = corpus_kind_t(header[8]);
+	corpus->size = (unsigned long)((corpus->length - header_size) / record_size);
+	return corpus;
+}
+
+void close_corpus(corpus_t* corpus)
+{
+#ifndef WIN32
+	munmap((void*)corpus->data, corpus->length);
+#else
+	free((void*)corpus->data);
+#endif
+	delete corpus;
+}
+
+corpus_kind_t corpus_kind(const corpus_t* corpus) { return corpus->kind; }
+unsigned long corpus_size(const corpus_t* corpus) { return corpus->size; }
+
+const deal_record_t* corpus_deals(const corpus_t* corpus)
+{
+	if (corpus->kind != deal_corpus) return 0;
+	return (const deal_record_t*)(corpus->data + header_size);
+}
+
+const result_record_t* corpus_results(const corpus_t* corpus)
+{
+	if (corpus->kind != result_corpus) return 0;
+	return (const result_record_t*)(corpus->data + header_size);
+}
@@ -0,0 +1,58 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Binary files of deals or results, with fixed-width records so that they can be mapped into memory
+//  and shared out between workers by index, without any parsing
+//
+
+#pragma once
+
+#include "types.h"
+#include "par.h"
+#include <stdio.h>
+
+// A complete deal: 2 bits per card for the holder, then the board number, declarer and trumps
+typedef struct deal_record_t {
+	unsigned char bytes[16];
+} deal_record_t;
+
+// The double-dummy table (4 bits per entry, [declarer][trumps]) and the par result
+typedef struct result_record_t {
+	unsigned char bytes[16];
+} result_record_t;
+
+// What a file holds
+typedef enum corpus_kind_t { deal_corpus, result_corpus } corpus_kind_t;
+
+// A file, mapped into memory
+struct corpus_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packing and unpacking records. Only complete deals can be packed; unpacking returns 0 if the record
+// isn't a valid deal. A deal that couldn't be solved gets a placeholder result, so that result i still
+// goes with deal i; unpacking returns 0 for one.
+void pack_deal(const deal_t*, deal_record_t*);
+int unpack_deal(const deal_record_t*, deal_t*);
+void pack_result(const deal_analysis_t*, const result_t*, result_record_t*);
+void pack_no_result(result_record_t*);
+int unpack_result(const result_record_t*, deal_analysis_t*, result_t*);
+
+// Writing a file: the header, then the records one after another with fwrite. Returns 0 on failure.
+int write_corpus_header(FILE*, corpus_kind_t);
+
+// Reading a file. Returns null if it can't be opened or isn't a corpus. The records stay valid until
+// the file is closed, and can be read from any number of threads.
+struct corpus_t* open_corpus(const char* filename);
+void close_corpus(struct corpus_t*);
+corpus_kind_t corpus_kind(const struct corpus_t*);
+unsigned long corpus_size(const struct corpus_t*);
+const deal_record_t* corpus_deals(const struct corpus_t*);			// null unless a deal corpus
+const result_record_t* corpus_results(const struct corpus_t*);		// null unless a result corpus
+
+#ifdef __cplusplus
+}
+#endif
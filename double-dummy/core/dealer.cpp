@@ -0,0 +1,376 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Implementation of the deal generator
+//
+
+#include "dealer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+	typedef unsigned long long uint64;
+	typedef unsigned int uint32;
+
+	// xoshiro256**, seeded through splitmix64
+	class random_t {
+	public:
+		void seed(uint64 seed, uint64 stream) {
+			uint64 z = mix(seed ^ mix(stream + 1));
+			for (int i = 0; i < 4; ++i) {
+				z += 0x9e3779b97f4a7c15ULL;
+				s[i] = mix(z);
+			}
+		}
+
+		uint64 next() {
+			const uint64 result = rotl(s[1] * 5, 7) * 9;
+			const uint64 t = s[1] << 17;
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+			return result;
+		}
+
+		// Uniform in [0, n), without the bias of taking a remainder
+		uint32 below(uint32 n) {
+			uint64 m = (next() >> 32) * n;
+			if (uint32(m) < n) {
+				const uint32 threshold = uint32(-n) % n;
+				while (uint32(m) < threshold)
+					m = (next() >> 32) * n;
+			}
+			return uint32(m >> 32);
+		}
+
+	private:
+		static uint64 rotl(uint64 x, int k) { return (x << k) | (x >> (64 - k)); }
+		static uint64 mix(uint64 z) {
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			return z ^ (z >> 31);
+		}
+		uint64 s[4];
+	};
+
+	inline int points(card_t c) { return std::max(0, int(rank(c)) - 8); }
+
+	// How far a hand has got
+	struct tally_t {
+		int hcp;
+		int length[4];
+		int slots;					// cards still to come
+	};
+
+	// After this many deals in a row have been abandoned, give up
+	const int max_attempts = 1 << 20;
+
+	// Binomial coefficients up to 52 choose 13
+	struct binomials_t {
+		uint64 c[53][14];
+		binomials_t() {
+			for (int n = 0; n <= 52; ++n) {
+				c[n][0] = 1;
+				for (int k = 1; k <= 13; ++k)
+					c[n][k] = (n == 0) ? 0 : c[n-1][k-1] + c[n-1][k];
+			}
+		}
+	};
+	const binomials_t binomial;
+
+	// A deal is numbered by the hands in turn: north's cards out of 52, east's out of the 39 left, and
+	// south's out of the 26 left after that; these are the numbers of choices after north's
+	const uint64 after_north = binomial.c[39][13] * binomial.c[26][13];
+
+	// 64 x 64 -> 128 bit multiplication
+	deal_number_t multiply(uint64 a, uint64 b)
+	{
+		const uint64 a0 = a & 0xffffffffULL, a1 = a >> 32, b0 = b & 0xffffffffULL, b1 = b >> 32;
+		const uint64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+		const uint64 middle = (p00 >> 32) + (p01 & 0xffffffffULL) + (p10 & 0xffffffffULL);
+		deal_number_t n;
+		n.low = (middle << 32) | (p00 & 0xffffffffULL);
+		n.high = p11 + (p01 >> 32) + (p10 >> 32) + (middle >> 32);
+		return n;
+	}
+
+	void add(deal_number_t& n, uint64 a)
+	{
+		n.low += a;
+		if (n.low < a) n.high++;
+	}
+
+	// 128 / 64 bit division, for when the quotient fits in 64 bits (that is, n.high < d)
+	uint64 divide(const deal_number_t& n, uint64 d, uint64& remainder)
+	{
+		uint64 r = n.high, q = 0;
+		for (int bit = 63; bit >= 0; --bit) {
+			const bool carry = (r >> 63) != 0;
+			r = (r << 1) | ((n.low >> bit) & 1);
+			q <<= 1;
+			if (carry || r >= d) {
+				r -= d;
+				q |= 1;
+			}
+		}
+		remainder = r;
+		return q;
+	}
+
+	// The cards at the given positions (in order, among the cards left) are numbered by the sum of
+	// (position choose how many so far), counting from 1; this finds the positions from the number
+	void unrank_positions(uint64 index, int n, int k, unsigned char* positions)
+	{
+		int p = n - 1;
+		for (int i = k; i >= 1; --i) {
+			while (binomial.c[p][i] > index) --p;
+			index -= binomial.c[p][i];
+			positions[i-1] = (unsigned char)p;
+			--p;
+		}
+	}
+}
+
+struct dealer_t {
+	deal_constraints_t constraints;
+	random_t random;
+	bool possible;
+	bool constrained;
+	int nfree;
+	card_t order[52];				// the cards to deal: honours first, so that points are settled early
+	player_t seats[52];				// a seat for each card to be dealt, shuffled as they're dealt
+	tally_t start[4];				// the fixed cards
+	int free_hcp, free_length[4];	// and the rest
+	unsigned long long rejections;
+
+	// Could the hand still meet its constraints, given what's left to deal?
+	bool feasible(const tally_t& t, const hand_constraint_t& h, int hcp_left, const int* length_left) const {
+		if (t.hcp > h.max_hcp || t.hcp + hcp_left < h.min_hcp) return false;
+		for (int s = 0; s < 4; ++s)
+			if (t.length[s] > h.max_length[s] || t.length[s] + std::min(length_left[s], t.slots) < h.min_length[s]) return false;
+		return true;
+	}
+};
+
+void no_constraints(deal_constraints_t* constraints)
+{
+	for (int c = 0; c < 52; ++c) constraints->holder[c] = plNone;
+	for (int pl = 0; pl < 4; ++pl) {
+		hand_constraint_t& h = constraints->hand[pl];
+		h.min_hcp = 0;
+		h.max_hcp = 37;
+		for (int s = 0; s < 4; ++s) {
+			h.min_length[s] = 0;
+			h.max_length[s] = 13;
+		}
+	}
+}
+
+void fix_hand(deal_constraints_t* constraints, const deal_t* deal, player_t pl)
+{
+	for (int c = 0; c < 52; ++c)
+		if (deal->holder[c] == pl) constraints->holder[c] = pl;
+}
+
+int meets_constraint(const deal_t* deal, player_t pl, const hand_constraint_t* h)
+{
+	int hcp = 0, length[4] = {0, 0, 0, 0};
+	for (card_t c = 0; c < 52; ++c) {
+		if (deal->holder[c] != pl) continue;
+		hcp += points(c);
+		length[suit(c)]++;
+	}
+	if (hcp < h->min_hcp || hcp > h->max_hcp) return 0;
+	for (int s = 0; s < 4; ++s)
+		if (length[s] < h->min_length[s] || length[s] > h->max_length[s]) return 0;
+	return 1;
+}
+
+dealer_t* new_dealer(const deal_constraints_t* constraints, unsigned long long seed, unsigned long long stream)
+{
+	dealer_t* dealer = new dealer_t;
+	dealer->constraints = *constraints;
+	dealer->random.seed(seed, stream);
+	dealer->rejections = 0;
+
+	// Tally up the fixed cards, and list the others from the top down
+	memset(dealer->start, 0, sizeof(dealer->start));
+	dealer->free_hcp = 0;
+	for (int s = 0; s < 4; ++s) dealer->free_length[s] = 0;
+	dealer->nfree = 0;
+	for (card_t c = 51; c >= 0; --c) {
+		const player_t pl = constraints->holder[c];
+		if (pl < plNone) {
+			dealer->start[pl].hcp += points(c);
+			dealer->start[pl].length[suit(c)]++;
+		} else {
+			dealer->order[dealer->nfree++] = c;
+			dealer->free_hcp += points(c);
+			dealer->free_length[suit(c)]++;
+		}
+	}
+
+	// A seat for each card still to deal
+	int n = 0;
+	dealer->possible = true;
+	dealer->constrained = false;
+	for (int pl = 0; pl < 4; ++pl) {
+		tally_t& t = dealer->start[pl];
+		t.slots = 13 - (t.length[0] + t.length[1] + t.length[2] + t.length[3]);
+		if (t.slots < 0) dealer->possible = false;
+		for (int i = 0; i < t.slots && n < 52; ++i)
+			dealer->seats[n++] = player_t(pl);
+		const hand_constraint_t& h = constraints->hand[pl];
+		if (h.min_hcp > 0 || h.max_hcp < 37) dealer->constrained = true;
+		for (int s = 0; s < 4; ++s)
+			if (h.min_length[s] > 0 || h.max_length[s] < 13) dealer->constrained = true;
+		if (!dealer->feasible(t, h, dealer->free_hcp, dealer->free_length)) dealer->possible = false;
+	}
+	if (n != dealer->nfree) dealer->possible = false;
+	return dealer;
+}
+
+void free_dealer(dealer_t* dealer)
+{
+	delete dealer;
+}
+
+// Each card in turn goes to a seat picked at random from those left, which is a shuffle of the seats,
+// so every deal is equally likely; stopping early when a hand fails keeps that true of the deals that are kept
+int next_deal(dealer_t* dealer, deal_t* deal)
+{
+	if (!dealer->possible) return 0;
+	const int nfree = dealer->nfree;
+	for (int attempt = 0; attempt < max_attempts; ++attempt) {
+		tally_t tally[4];
+		memcpy(tally, dealer->start, sizeof(tally));
+		int hcp_left = dealer->free_hcp;
+		int length_left[4];
+		memcpy(length_left, dealer->free_length, sizeof(length_left));
+		bool ok = true;
+		for (int i = 0; i < nfree; ++i) {
+			const int j = i + int(dealer->random.below(uint32(nfree - i)));
+			std::swap(dealer->seats[i], dealer->seats[j]);
+			if (!dealer->constrained) continue;
+
+			const player_t pl = dealer->seats[i];
+			const card_t c = dealer->order[i];
+			tally[pl].hcp += points(c);
+			tally[pl].length[suit(c)]++;
+			tally[pl].slots--;
+			hcp_left -= points(c);
+			length_left[suit(c)]--;
+			// The hand that got the card, in full; the others only lost a chance of getting it
+			ok = dealer->feasible(tally[pl], dealer->constraints.hand[pl], hcp_left, length_left);
+			for (int p = 0; p < 4 && ok; ++p) {
+				const hand_constraint_t& h = dealer->constraints.hand[p];
+				ok = tally[p].hcp + hcp_left >= h.min_hcp
+					&& tally[p].length[suit(c)] + std::min(length_left[suit(c)], tally[p].slots) >= h.min_length[suit(c)];
+			}
+			if (!ok) break;
+		}
+		if (!ok) {
+			dealer->rejections++;
+			continue;
+		}
+
+		for (int c = 0; c < 52; ++c)
+			deal->holder[c] = dealer->constraints.holder[c];
+		for (int i = 0; i < nfree; ++i)
+			deal->holder[dealer->order[i]] = dealer->seats[i];
+		return 1;
+	}
+	return 0;
+}
+
+unsigned long long dealer_rejections(const dealer_t* dealer)
+{
+	return dealer->rejections;
+}
+
+// Numbering of deals
+void number_of_deals(deal_number_t* n)
+{
+	*n = multiply(binomial.c[52][13], after_north);
+}
+
+void rank_deal(const deal_t* deal, deal_number_t* n)
+{
+	uint64 index[3] = {0, 0, 0};
+	int count[3] = {0, 0, 0};
+	int position[3] = {0, 0, 0};		// among the cards left for the hand
+	for (card_t c = 0; c < 52; ++c) {
+		const int holder = deal->holder[c];
+		for (int pl = plN; pl <= plS && pl <= holder; ++pl) {
+			if (pl == holder) index[pl] += binomial.c[position[pl]][++count[pl]];
+			position[pl]++;
+		}
+	}
+	*n = multiply(index[plN], after_north);
+	add(*n, index[plE] * binomial.c[26][13] + index[plS]);
+}
+
+int unrank_deal(const deal_number_t* n, deal_t* deal)
+{
+	deal_number_t total;
+	number_of_deals(&total);
+	if (n->high > total.high || (n->high == total.high && n->low >= total.low)) return 0;
+	uint64 rest;
+	uint64 index[3];
+	index[plN] = divide(*n, after_north, rest);
+	index[plE] = rest / binomial.c[26][13];
+	index[plS] = rest % binomial.c[26][13];
+
+	// Each hand picks its cards out of those the hands before it left
+	card_t left[52];
+	int nleft = 52;
+	for (int c = 0; c < 52; ++c) left[c] = c;
+	for (int pl = plN; pl <= plS; ++pl) {
+		unsigned char positions[13];
+		unrank_positions(index[pl], nleft, 13, positions);
+		int k = 0, m = 0;
+		for (int i = 0; i < nleft; ++i) {
+			if (k < 13 && positions[k] == i) {
+				deal->holder[left[i]] = player_t(pl);
+				k++;
+			} else {
+				left[m++] = left[i];
+			}
+		}
+		nleft = m;
+	}
+	for (int i = 0; i < nleft; ++i)
+		deal->holder[left[i]] = plW;
+	return 1;
+}
+
+// Numbering of the east-west splits
+unsigned long rank_split(const deal_t* deal)
+{
+	uint64 index = 0;
+	int count = 0, position = 0;
+	for (card_t c = 0; c < 52; ++c) {
+		if (deal->holder[c] == plN || deal->holder[c] == plS) continue;
+		if (deal->holder[c] == plE) index += binomial.c[position][++count];
+		position++;
+	}
+	return (unsigned long)index;
+}
+
+void unrank_split(deal_t* deal, unsigned long index)
+{
+	unsigned char positions[13];
+	unrank_positions(index, 26, 13, positions);
+	int k = 0, position = 0;
+	for (card_t c = 0; c < 52; ++c) {
+		if (deal->holder[c] == plN || deal->holder[c] == plS) continue;
+		deal->holder[c] = (k < 13 && positions[k] == position) ? plE : plW;
+		if (deal->holder[c] == plE) k++;
+		position++;
+	}
+}
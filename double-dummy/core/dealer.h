@@ -0,0 +1,77 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Random deals for simulations: reproducible from a seed, independent between threads, and with
+//  some cards or hands fixed and the others limited by points and shape. Also the numbering of deals,
+//  so that all of them (or all the ways of splitting the east-west cards) can be shared out by index.
+//
+
+#pragma once
+
+#include "types.h"
+
+// What a hand may hold. Points are the usual 4-3-2-1 count; lengths are indexed by suit_t.
+typedef struct hand_constraint_t {
+	int min_hcp, max_hcp;
+	int min_length[4], max_length[4];
+} hand_constraint_t;
+
+// The cards that are already placed (plNone for those to be dealt), and what each hand may hold
+typedef struct deal_constraints_t {
+	player_t holder[52];
+	hand_constraint_t hand[4];
+} deal_constraints_t;
+
+// A stream of deals
+struct dealer_t;
+
+// A deal's number: there are about 2^95 deals, so it takes two words
+typedef struct deal_number_t {
+	unsigned long long high, low;
+} deal_number_t;
+
+// The number of ways to split 26 cards between two hands
+#define SPLITS 10400600UL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// No cards placed, and anything allowed
+void no_constraints(deal_constraints_t*);
+
+// Places every card the deal gives to one of the players
+void fix_hand(deal_constraints_t*, const deal_t*, player_t);
+
+// Does the player's hand in the deal meet the constraint? Returns 1 if so.
+int meets_constraint(const deal_t*, player_t, const hand_constraint_t*);
+
+// Starts a stream of deals. The same seed and stream number always give the same deals; different
+// stream numbers give independent deals, so each thread can have its own. The constraints are copied.
+struct dealer_t* new_dealer(const deal_constraints_t*, unsigned long long seed, unsigned long long stream);
+void free_dealer(struct dealer_t*);
+
+// Deals the cards for the next deal, each deal that meets the constraints being equally likely. The rest
+// of the deal (board, declarer and trumps) is left alone. The deal is abandoned as soon as a hand can no
+// longer meet its constraints, and a new one started; returns 0 if that keeps happening (the constraints
+// are impossible, or nearly so), 1 otherwise.
+int next_deal(struct dealer_t*, deal_t*);
+
+// The number of deals abandoned so far
+unsigned long long dealer_rejections(const struct dealer_t*);
+
+// Numbering of complete deals, from 0 up to (not including) the number of deals. Only the hands count;
+// unranking leaves the rest of the deal alone, and returns 0 if the number is out of range.
+void number_of_deals(deal_number_t*);
+void rank_deal(const deal_t*, deal_number_t*);
+int unrank_deal(const deal_number_t*, deal_t*);
+
+// Numbering of the ways east and west can hold the 26 cards that north and south don't, from 0 up to
+// SPLITS. The deal must have complete hands for north and south; unranking deals the rest.
+unsigned long rank_split(const deal_t*);
+void unrank_split(deal_t*, unsigned long);
+
+#ifdef __cplusplus
+}
+#endif
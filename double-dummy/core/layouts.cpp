@@ -0,0 +1,192 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Implementation of the enumeration of east-west layouts
+//
+
+#include "layouts.h"
+#include "analyzer.h"
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+	// Layouts are taken in the order of a fixed pseudo-random permutation of their numbers: a Feistel
+	// network on 24 bits, applied again until the result is in range
+	unsigned long permute(unsigned long i)
+	{
+		do {
+			unsigned long left = i >> 12, right = i & 0xfff;
+			for (unsigned long round = 0; round < 4; ++round) {
+				unsigned long f = (right + round) * 0x9e3779b1UL;
+				f = (f ^ (f >> 15)) * 0x2c1b3c6dUL;
+				const unsigned long next = left ^ ((f >> 12) & 0xfff);
+				left = right;
+				right = next;
+			}
+			i = (left << 12) | right;
+		} while (i >= SPLITS);
+		return i;
+	}
+
+	// The layouts handed out to a thread at a time
+	const unsigned long batch = 16;
+
+	// How often the caller hears how it's going
+	const int report_ms = 250;
+
+	// The 95% half-width for a proportion (Agresti-Coull)
+	double half_width(unsigned long made, unsigned long n)
+	{
+		const double m = n + 4.0, p = (made + 2.0) / m;
+		return 1.96 * sqrt(p * (1 - p) / m);
+	}
+
+	// The number of layouts counted in which declarer takes at least so many tricks
+	unsigned long at_least(const unsigned long* tricks, int n)
+	{
+		unsigned long total = 0;
+		for (int t = n; t <= 13; ++t) total += tricks[t];
+		return total;
+	}
+
+	// The least certain make-probability for any contract, in all and after each lead
+	double least_certain(const layout_result_t& r)
+	{
+		double error = 0;
+		for (int t = 7; t <= 13; ++t) {
+			error = std::max(error, half_width(at_least(r.tricks, t), r.solved));
+			for (int c = 0; c < 52; ++c)
+				if (r.leads[c]) error = std::max(error, half_width(at_least(r.lead_tricks[c], t), r.leads[c]));
+		}
+		return error;
+	}
+
+	void merge(layout_result_t& into, const layout_result_t& from)
+	{
+		into.examined += from.examined;
+		into.consistent += from.consistent;
+		into.solved += from.solved;
+		for (int t = 0; t <= 13; ++t) into.tricks[t] += from.tricks[t];
+		for (int c = 0; c < 52; ++c) {
+			into.leads[c] += from.leads[c];
+			for (int t = 0; t <= 13; ++t) into.lead_tricks[c][t] += from.lead_tricks[c][t];
+		}
+	}
+
+	struct enumeration_t {
+		const layout_query_t* query;
+		std::atomic<unsigned long> next;
+		std::atomic<int> stop;
+		int running;
+		std::mutex mutex;
+		std::condition_variable finished;
+		layout_result_t total;			// guarded by the mutex
+	};
+
+	// One layout: the opening position, with every lead if we're asked for them
+	void solve(const enumeration_t& e, const deal_t& deal, cache_t* cache, layout_result_t& tally)
+	{
+		play_t play;
+		play.nCardsPlayed = 0;
+		position_analysis_t pos;
+		pos.global.low = 0;
+		pos.global.high = 1 + 13;
+		for (int i = 0; i < 52; ++i)
+			pos.play[i] = pos.global;
+		clear_cache(cache);
+		analyze(&deal, &play, cache, 0, &pos, e.query->leads ? all_moves : best_only);
+
+		// The bounds are for the side on lead
+		tally.solved++;
+		tally.tricks[13 - pos.global.low]++;
+		if (!e.query->leads) return;
+		const player_t leader = nextpl(deal.declarer);
+		for (card_t c = 0; c < 52; ++c) {
+			if (deal.holder[c] != leader) continue;
+			tally.leads[c]++;
+			tally.lead_tricks[c][13 - pos.play[c].low]++;
+		}
+	}
+
+	void work(enumeration_t* e)
+	{
+		cache_t* cache = new_cache();
+		layout_result_t tally;
+		while (!e->stop) {
+			memset(&tally, 0, sizeof(tally));
+			const unsigned long start = e->next.fetch_add(batch);
+			for (unsigned long i = start; i < std::min(start + batch, SPLITS) && !e->stop; ++i) {
+				deal_t deal = e->query->deal;
+				unrank_split(&deal, permute(i));
+				tally.examined++;
+				if (!meets_constraint(&deal, plE, &e->query->east) || !meets_constraint(&deal, plW, &e->query->west)) continue;
+				tally.consistent++;
+				solve(*e, deal, cache, tally);
+			}
+			std::lock_guard<std::mutex> lock(e->mutex);
+			merge(e->total, tally);
+			if (start + batch >= SPLITS) break;
+		}
+		free_cache(cache);
+		std::lock_guard<std::mutex> lock(e->mutex);
+		e->running--;
+		e->finished.notify_all();
+	}
+}
+
+// Solve the layouts until we know enough
+int enumerate_layouts(const layout_query_t* query, layout_callback_t callback, layout_result_t* result)
+{
+	enumeration_t e;
+	e.query = query;
+	e.next = 0;
+	e.stop = 0;
+	e.running = std::max(1, query->threads);
+	memset(&e.total, 0, sizeof(e.total));
+	e.total.context = result->context;
+	std::vector<std::thread> pool;
+	for (int i = 0; i < e.running; ++i)
+		pool.push_back(std::thread(work, &e));
+
+	// Report now and then, and see whether that's enough
+	int rv = 1;
+	{
+		std::unique_lock<std::mutex> lock(e.mutex);
+		while (e.running > 0) {
+			e.finished.wait_for(lock, std::chrono::milliseconds(report_ms));
+			e.total.complete = (e.running == 0 && !e.stop && e.total.examined == SPLITS);
+			e.total.error = e.total.complete ? 0 : least_certain(e.total);
+			*result = e.total;
+			if (e.stop || e.running == 0) continue;
+			if (query->tolerance > 0 && e.total.solved > 0 && e.total.error <= query->tolerance) e.stop = 1;
+			lock.unlock();
+			if (callback && !callback(result)) {
+				e.stop = 1;
+				rv = 0;
+			}
+			lock.lock();
+		}
+	}
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+	e.total.complete = (e.total.examined == SPLITS);
+	e.total.error = e.total.complete ? 0 : least_certain(e.total);
+	*result = e.total;
+	return rv;
+}
+
+double make_probability(const layout_result_t* result, int tricks, card_t lead)
+{
+	const unsigned long n = (lead < 0) ? result->solved : result->leads[lead];
+	if (n == 0) return 0;
+	return double(at_least((lead < 0) ? result->tricks : result->lead_tricks[lead], tricks)) / n;
+}
@@ -0,0 +1,55 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Solving every way the east-west cards can lie, given north and south's hands, to find exactly how
+//  likely each contract is to make, and with which opening leads
+//
+
+#pragma once
+
+#include "types.h"
+#include "dealer.h"
+
+// What to look at
+typedef struct layout_query_t {
+	deal_t deal;					// north and south's hands, declarer and trumps; the rest is ignored
+	hand_constraint_t east, west;	// which layouts count
+	int leads;						// 1 to find the result of every opening lead too, which takes longer
+	double tolerance;				// stop once every estimate is within this (at 95%), or 0 to solve every layout
+	int threads;
+} layout_query_t;
+
+// What's been found, over the layouts solved so far. Each layout that meets the constraints is as
+// likely as any other, so the proportions are probabilities. Tricks are for declarer's side.
+typedef struct layout_result_t {
+	unsigned long examined;			// layouts looked at, out of SPLITS
+	unsigned long consistent;		// of those, the ones that meet the constraints
+	unsigned long solved;			// and of those, the ones solved
+	unsigned long tricks[14];		// the number of layouts in which declarer takes exactly so many tricks
+	unsigned long leads[52];		// the number of layouts in which each card could be led
+	unsigned long lead_tricks[52][14];	// and the tricks after leading it
+	double error;					// the 95% half-width of the least certain make-probability
+	int complete;					// 1 once every layout has been solved
+	void* context;					// context for the caller
+} layout_result_t;
+
+// Called with the results so far, every so often; return 0 to stop early
+typedef int (*layout_callback_t)(layout_result_t*);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Solves the layouts on the given number of threads, in an order that makes any prefix of them a fair
+// sample, until every one is solved or the estimates are within the tolerance. Returns 1 if it stopped
+// because of that, or 0 if the callback stopped it.
+int enumerate_layouts(const layout_query_t*, layout_callback_t, layout_result_t*);
+
+// The proportion of the layouts solved in which declarer takes at least so many tricks, in all or after
+// the given lead (or -1 for any lead)
+double make_probability(const layout_result_t*, int tricks, card_t lead);
+
+#ifdef __cplusplus
+}
+#endif
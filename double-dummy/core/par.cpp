@@ -2,6 +2,7 @@
 // It is made available under the GPL; see the file COPYING for details
 
 #include "par.h"
+#include "analyzer.h"
 #include <algorithm>
 
 namespace {
@@ -21,12 +22,13 @@ namespace {
 	};	
 
 	// Scoring
-	int score(suit_t trumps, int level, int tricks, bool vul)
+	int score(suit_t trumps, int level, int tricks, bool vul, bool doubled = true)
 	{
 		// Undertricks, assumed doubled (for par computation)
 		const int target = level+6;
 		if (tricks < target) {
 			int down = (target-tricks);
+			if (!doubled) return -down * (vul ? 100 : 50);
 			if (vul) {
 				if (down == 1) return -200;
 				else return -500 - 300 * (down-2);
@@ -79,87 +81,263 @@ namespace {
 		return 3;
 	}
 
+	// The source of trick counts for the par calculation can be a complete double-dummy table...
+	struct table_tricks_t {
+		const deal_analysis_t* analysis;
+		table_tricks_t(const deal_analysis_t* analysis) : analysis(analysis) { }
+		bool atleast(player_t declarer, suit_t trumps, int tricks) { return analysis->tricks[declarer][trumps] >= tricks; }
+	};
+
+	// ...or the solver, in which case each count is only worked out as precisely as the par calculation needs
+	struct solver_tricks_t {
+		deal_t deal;
+		play_t play;
+		cache_t* cache[5];			// per trump suit
+		bound_t bound[4][5];		// [declarer][trumps]
+		int searches;
+
+		solver_tricks_t(const deal_t& d) : deal(d), searches(0)
+		{
+			play.nCardsPlayed = 0;
+			for (int s = 0; s < 5; ++s) {
+				cache[s] = 0;
+				for (int pl = 0; pl < 4; ++pl) {
+					bound[pl][s].low = 0;
+					bound[pl][s].high = 1 + 13;
+				}
+			}
+		}
+
+		~solver_tricks_t()
+		{
+			for (int s = 0; s < 5; ++s)
+				if (cache[s]) free_cache(cache[s]);
+		}
+
+		bool atleast(player_t declarer, suit_t trumps, int tricks)
+		{
+			bound_t& b = bound[declarer][trumps];
+			if (tricks <= b.low) return true;
+			if (tricks >= b.high) return false;
+			if (!cache[trumps]) cache[trumps] = new_cache();
+			deal.declarer = declarer;
+			deal.trumps = trumps;
+			searches++;
+			if (can_make(&deal, &play, cache[trumps], partnership(declarer), tricks, 0)) {
+				b.low = tricks;
+				return true;
+			} else {
+				b.high = tricks;
+				return false;
+			}
+		}
+	};
+
 	// Stores info on a partnership's result in a contract
 	struct partnershipResult_t
 	{
 		int score;
 		player_t declarer;
+		int tricks;
 	};
 
 	// Compute result for a partnership
-	partnershipResult_t partnershipResult(int level, suit_t trumps, const deal_analysis_t* analysis, partnership_t p, const board_t& board)
+	template <class tricks_t>
+	partnershipResult_t partnershipResult(int level, suit_t trumps, tricks_t& tricks, partnership_t p, const board_t& board)
 	{
 		player_t p0 = first(p, board.dealer);
 		player_t p1 = partner(p0);
-		int t0 = analysis->tricks[p0][trumps],
-			t1 = analysis->tricks[p1][trumps];
+		
+		// Find the better of the two declarers' trick counts
+		int low = 0, high = 1 + 13;
+		while (low+1 < high) {
+			int mid = (low + high) / 2;
+			if (tricks.atleast(p0, trumps, mid) || tricks.atleast(p1, trumps, mid)) low = mid; else high = mid;
+		}
 		partnershipResult_t rv;
-		rv.score = score(trumps, level, std::max(t0, t1), board.vul[p]);
-		rv.declarer = (t1 > t0) ? p1 : p0;
+		rv.tricks = low;
+		rv.score = score(trumps, level, rv.tricks, board.vul[p]);
+		rv.declarer = tricks.atleast(p0, trumps, rv.tricks) ? p0 : p1;
 		return rv;
 	}
-}
 
-// Par calculation
-void analyze_par(int boardnumber, const deal_analysis_t* analysis, result_t* par)
-{
-	// Get dealer and vulnerability
-	board_t board(boardnumber);
-	
-	// First assemble the scores for each contract for each partnership
-	partnershipResult_t pres[2][39];
-	for (int trumps = 0; trumps < 5; ++trumps) {
-		for (int level = 1; level <= 7; ++level) {
-			int i = contractIndex(level, suit_t(trumps));
-			pres[pNS][i] = partnershipResult(level, suit_t(trumps), analysis, pNS, board);
-			pres[pEW][i] = partnershipResult(level, suit_t(trumps), analysis, pEW, board);
+	// Whether a partnership can score more than the given amount in a contract
+	template <class tricks_t>
+	bool scoresMore(int level, suit_t trumps, tricks_t& tricks, partnership_t p, const board_t& board, int than)
+	{
+		// Scores only go up with more tricks, so find the fewest that would do
+		for (int t = 0; t <= 13; ++t) {
+			if (score(trumps, level, t, board.vul[p]) > than) {
+				player_t p0 = first(p, board.dealer);
+				return tricks.atleast(p0, trumps, t) || tricks.atleast(partner(p0), trumps, t);
+			}
 		}
+		return false;
 	}
 
-	// Best so far is passed out
-	int index = 0;
-	player_t decl;
-	bool improved = true;
-	int bestScoreNS = 0;
-	
-	while (improved) {
-		improved = false;
+	// Par calculation, asking for trick counts only as needed
+	template <class tricks_t>
+	void compute_par(int boardnumber, tricks_t& tricks, result_t* par)
+	{
+		// Get dealer and vulnerability
+		board_t board(boardnumber);
+
+		// Best so far is passed out
+		int index = 0;
+		partnershipResult_t best = {};
+		partnership_t bestside = pNS;
+		bool improved = true;
+		int bestScoreNS = 0;
 		
-		// Can N/S do better?
-		for (int i = 1+index; i <= contractIndex(7, nt); ++i) {
-			if (pres[pNS][i].score > bestScoreNS) {
-				index = i;
-				decl = pres[pNS][i].declarer;
-				bestScoreNS = pres[pNS][i].score;
-				improved = true;
+		while (improved) {
+			improved = false;
+			
+			// Can N/S do better?
+			for (int i = 1+index; i <= contractIndex(7, nt); ++i) {
+				const int level = ((i-1) / 5) + 1;
+				const suit_t trumps = suit_t((i-1) % 5);
+				if (scoresMore(level, trumps, tricks, pNS, board, bestScoreNS)) {
+					index = i;
+					best = partnershipResult(level, trumps, tricks, pNS, board);
+					bestside = pNS;
+					bestScoreNS = best.score;
+					improved = true;
+				}
 			}
-		}
-				
-		// Can E/W do better?		
-		for (int i = 1+index; i <= contractIndex(7, nt); ++i) {
-			if (pres[pEW][i].score > -bestScoreNS) {
-				index = i;
-				decl = pres[pEW][i].declarer;
-				bestScoreNS = -pres[pEW][i].score;
-				improved = true;
+					
+			// Can E/W do better?		
+			for (int i = 1+index; i <= contractIndex(7, nt); ++i) {
+				const int level = ((i-1) / 5) + 1;
+				const suit_t trumps = suit_t((i-1) % 5);
+				if (scoresMore(level, trumps, tricks, pEW, board, -bestScoreNS)) {
+					index = i;
+					best = partnershipResult(level, trumps, tricks, pEW, board);
+					bestside = pEW;
+					bestScoreNS = -best.score;
+					improved = true;
+				}
+			}
+			
+			// Would both sides like to declare the same contract? If so, see who gets to do it first.
+			if (improved) {
+				const int level = ((index-1) / 5) + 1;
+				const suit_t trumps = suit_t((index-1) % 5);
+				const partnership_t other = partnership_t(1-bestside);
+				if (scoresMore(level, trumps, tricks, other, board, -best.score)) {
+					partnershipResult_t rival = partnershipResult(level, trumps, tricks, other, board);
+					if (order(rival.declarer, board.dealer) < order(best.declarer, board.dealer)) {
+						best = rival;
+						bestside = other;
+						bestScoreNS = (other == pNS ? +1 : -1) * best.score;
+					}
+				}
 			}
 		}
 		
-		// Would both sides like to declare the same contract? If so, see who gets to do it first.
-		partnership_t p = partnership(decl);	
-		if (improved && pres[1-p][index].score > -pres[p][index].score) {
-			if (order(pres[1-p][index].declarer, board.dealer) < order(pres[p][index].declarer, board.dealer)) {
-				p = partnership_t(1-p);
-				decl = pres[p][index].declarer;
-				bestScoreNS = (p == pNS ? +1 : -1) * pres[p][index].score;
-			}
+		// Assemble the par contract
+		if (index == 0) {
+			par->level = 0;
+			par->trumps = nt;
+			par->declarer = plNone;
+			par->tricks = 0;
+			par->score = 0;
+		} else {
+			par->level = ((index-1) / 5) + 1;
+			par->trumps = suit_t((index-1) % 5);
+			par->declarer = best.declarer;
+			par->tricks = best.tricks;
+			par->score = best.score;
 		}
 	}
-	
-	// Assemble the par contract
-	par->level = ((index-1) / 5) + 1;
-	par->trumps = suit_t((index-1) % 5);
-	par->declarer = decl;
-	par->tricks = analysis->tricks[decl][par->trumps];
-	par->score = pres[partnership(decl)][index].score;
+
+	// The most tricks a side can take in notrumps, whoever is on lead: it can only win a trick in
+	// a suit while one of the partnership still holds a card in it
+	int notrump_limit(const deal_t& deal, partnership_t p)
+	{
+		int length[4][4] = {{0}};		// [player][suit]
+		for (card_t c = 0; c < 52; ++c)
+			length[deal.holder[c]][suit(c)]++;
+		const player_t p0 = player_t(p), p1 = partner(p0);
+		int limit = 0;
+		for (int s = 0; s < 4; ++s)
+			limit += std::max(length[p0][s], length[p1][s]);
+		return std::min(limit, 13);
+	}
+
+	// Whether declarer can make the goal, counting the searches
+	struct declarer_probe_t {
+		const deal_t* deal;
+		cache_t* cache;
+		int* searches;
+	};
+
+	int probe_declarer(int goal, void* context)
+	{
+		declarer_probe_t& p = *(declarer_probe_t*)context;
+		play_t play;
+		play.nCardsPlayed = 0;
+		(*p.searches)++;
+		return can_make(p.deal, &play, p.cache, partnership(p.deal->declarer), goal, 0);
+	}
+
+	// Find declarer's tricks within a window, probing outwards from a guess
+	int solve_tricks(const deal_t& deal, cache_t* cache, int guess, bound_t window, int& searches)
+	{
+		declarer_probe_t probe = { &deal, cache, &searches };
+		probe_tricks(&window, guess, probe_declarer, &probe);
+		return window.low;
+	}
+}
+
+// Double-dummy table
+void analyze_deal(const deal_t* deal, deal_analysis_t* analysis, int* searches)
+{
+	deal_t d = *deal;
+	int count = 0;
+	for (int s = 0; s <= 4; ++s) {
+		cache_t* cache = new_cache();
+		d.trumps = suit_t(s);
+		
+		// The first declarer starts from the static estimate. Partners almost always make the same
+		// number of tricks, or one apart, so after that each partner's result is the guess for the
+		// other, and the opponents take roughly the rest.
+		play_t play;
+		play.nCardsPlayed = 0;
+		d.declarer = plN;
+		int guess = estimate_tricks(&d, &play, pNS);
+		const player_t declarers[4] = { plN, plS, plE, plW };
+		for (int i = 0; i < 4; ++i) {
+			const player_t pl = declarers[i];
+			if (i == 2) guess = 13 - (analysis->tricks[plN][s] + analysis->tricks[plS][s] + 1) / 2;
+			bound_t window;
+			window.low = 0;
+			window.high = 1 + ((s == nt) ? notrump_limit(d, partnership(pl)) : 13);
+			d.declarer = pl;
+			analysis->tricks[pl][s] = solve_tricks(d, cache, guess, window, count);
+			guess = analysis->tricks[pl][s];
+		}
+		free_cache(cache);
+	}
+	if (searches) *searches = count;
+}
+
+// The score for a contract
+int contract_score(suit_t trumps, int level, int tricks, int vulnerable, int doubled)
+{
+	return score(trumps, level, tricks, vulnerable != 0, doubled != 0);
+}
+
+// Par calculation
+void analyze_par(int boardnumber, const deal_analysis_t* analysis, result_t* par)
+{
+	table_tricks_t tricks(analysis);
+	compute_par(boardnumber, tricks, par);
+}
+
+// Par calculation straight from the deal
+void solve_par(const deal_t* deal, result_t* par, int* searches)
+{
+	solver_tricks_t tricks(*deal);
+	compute_par(deal->board, tricks, par);
+	if (searches) *searches = tricks.searches;
 }
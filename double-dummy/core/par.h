@@ -17,4 +17,17 @@ typedef struct result_t {
 	int score;			// for declarer
 } result_t;
 
+// Works out the double-dummy table for a deal (ignoring its declarer and trumps), sharing what each
+// result says about the others. Optionally reports the number of searches this took.
+extern "C" void analyze_deal(const deal_t* deal, deal_analysis_t* analysis, int* searches);
+
+// The score for declarer in a contract, making the given number of tricks. Only undertricks are scored as
+// doubled, if asked; par assumes that any contract that goes off is doubled.
+extern "C" int contract_score(suit_t trumps, int level, int tricks, int vulnerable, int doubled);
+
+// Works out the par result from a complete double-dummy table
 extern "C" void analyze_par(int board, const deal_analysis_t* analysis, result_t* result);
+
+// Works out the par result for a deal, solving only as much of the double-dummy table as the result
+// depends on. Optionally reports the number of searches this took.
+extern "C" void solve_par(const deal_t* deal, result_t* result, int* searches);
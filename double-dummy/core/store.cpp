@@ -0,0 +1,300 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  Implementation of the store of solved deals
+//
+
+#include "store.h"
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <cstdio>
+#include <string>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+namespace {
+
+	// The file is a header and then fixed-width records: the hands (as below), the table with 4 bits
+	// per entry ([declarer][trumps]), and a marker in the last byte that says the record is all there
+	const char magic[8] = { 'F', 'F', 'S', 'T', 'O', 'R', 'E', '1' };
+	const size_t header_size = 16;
+	const size_t record_size = 32;
+	const size_t table_offset = 16;
+	const unsigned char complete = 0x5a;
+
+	// The hands, as 2 bits per card for the holder, turned round the table so that the bytes come
+	// out smallest; that way every rotation of a deal has the same key
+	struct deal_key_t {
+		unsigned char bytes[13];
+		bool operator<(const deal_key_t& other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) < 0; }
+	};
+
+	// The key for a deal, and how many seats clockwise it turned the hands
+	int canonical(const deal_t* deal, deal_key_t& key)
+	{
+		int best = -1;
+		for (int turn = 0; turn < 4; ++turn) {
+			deal_key_t k;
+			memset(k.bytes, 0, sizeof(k.bytes));
+			for (card_t c = 0; c < 52; ++c)
+				k.bytes[c/4] |= ((deal->holder[c] + turn) & 3) << (2*(c%4));
+			if (best < 0 || k < key) { key = k; best = turn; }
+		}
+		return best;
+	}
+
+	// A table as stored, for the turned hands
+	struct table_t {
+		unsigned char tricks[10];
+	};
+
+	void pack_table(const deal_analysis_t* analysis, int turn, table_t& table)
+	{
+		memset(table.tricks, 0, sizeof(table.tricks));
+		for (int pl = 0; pl < 4; ++pl)
+			for (int s = 0; s <= 4; ++s) {
+				const int i = ((pl + turn) % 4) * 5 + s;
+				table.tricks[i/2] |= (analysis->tricks[pl][s] & 15) << (4*(i%2));
+			}
+	}
+
+	void unpack_table(const table_t& table, int turn, deal_analysis_t* analysis)
+	{
+		for (int pl = 0; pl < 4; ++pl)
+			for (int s = 0; s <= 4; ++s) {
+				const int i = ((pl + turn) % 4) * 5 + s;
+				analysis->tricks[pl][s] = (table.tricks[i/2] >> (4*(i%2))) & 15;
+			}
+	}
+
+	bool complete_deal(const deal_t* deal)
+	{
+		int count[5] = {0, 0, 0, 0, 0};
+		for (card_t c = 0; c < 52; ++c) count[deal->holder[c]]++;
+		return count[plN] == 13 && count[plE] == 13 && count[plS] == 13;
+	}
+}
+
+struct result_store_t {
+	std::mutex mutex;
+	std::map<deal_key_t, table_t> known;
+	size_t scanned;					// how much of the file has been read
+#ifndef WIN32
+	int fd;
+#else
+	FILE* file;
+#endif
+
+	// Reads any records added to the file since last time; returns false if it isn't a store
+	bool refresh();
+
+	// Adds a record to the end of the file, in one go
+	void append(const unsigned char* record);
+
+	// Cuts off the end of a record that was never finished (say the process writing it died), which
+	// would otherwise put every record after it out of step; only called with nobody else appending
+	void drop_torn_record();
+};
+
+namespace {
+	// Where the last whole record in a file of the given length ends
+	size_t record_boundary(size_t length)
+	{
+		return (length < header_size) ? length : length - (length - header_size) % record_size;
+	}
+}
+
+#ifndef WIN32
+
+bool result_store_t::refresh()
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return false;
+	const size_t length = st.st_size;
+	if (length < header_size) return false;
+	if (scanned > 0 && length < scanned + record_size) return true;
+	void* data = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) return false;
+	const unsigned char* bytes = (const unsigned char*)data;
+	bool ok = true;
+	if (scanned == 0) {
+		ok = memcmp(bytes, magic, sizeof(magic)) == 0;
+		scanned = header_size;
+	}
+	for (; ok && scanned + record_size <= length; scanned += record_size) {
+		const unsigned char* record = bytes + scanned;
+		if (record[record_size-1] != complete) break;
+		deal_key_t key;
+		table_t table;
+		memcpy(key.bytes, record, sizeof(key.bytes));
+		memcpy(table.tricks, record + table_offset, sizeof(table.tricks));
+		known.insert(std::make_pair(key, table));
+	}
+	munmap(data, length);
+	return ok;
+}
+
+void result_store_t::drop_torn_record()
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return;
+	const size_t boundary = record_boundary(st.st_size);
+	if (boundary == size_t(st.st_size)) return;
+	fprintf(stderr, "result store: dropping %d bytes of an unfinished record\n", int(st.st_size - boundary));
+	if (ftruncate(fd, boundary) != 0) perror("result store");
+}
+
+// Appending processes take turns, so that a short record at the end can only be one that was torn
+void result_store_t::append(const unsigned char* record)
+{
+	flock(fd, LOCK_EX);
+	drop_torn_record();
+	if (write(fd, record, record_size) != ssize_t(record_size)) perror("result store");
+	flock(fd, LOCK_UN);
+}
+
+#else
+
+// No mmap, so read the new records with stdio
+bool result_store_t::refresh()
+{
+	fseek(file, 0, SEEK_END);
+	const size_t length = ftell(file);
+	if (length < header_size) return false;
+	if (scanned == 0) {
+		char header[header_size];
+		fseek(file, 0, SEEK_SET);
+		if (fread(header, 1, header_size, file) != header_size || memcmp(header, magic, sizeof(magic)) != 0) return false;
+		scanned = header_size;
+	}
+	fseek(file, long(scanned), SEEK_SET);
+	unsigned char record[record_size];
+	for (; scanned + record_size <= length && fread(record, 1, record_size, file) == record_size; scanned += record_size) {
+		if (record[record_size-1] != complete) break;
+		deal_key_t key;
+		table_t table;
+		memcpy(key.bytes, record, sizeof(key.bytes));
+		memcpy(table.tricks, record + table_offset, sizeof(table.tricks));
+		known.insert(std::make_pair(key, table));
+	}
+	return true;
+}
+
+void result_store_t::drop_torn_record()
+{
+	fseek(file, 0, SEEK_END);
+	const size_t length = ftell(file);
+	const size_t boundary = record_boundary(length);
+	if (boundary == length) return;
+	fprintf(stderr, "result store: dropping %d bytes of an unfinished record\n", int(length - boundary));
+	fflush(file);
+	if (_chsize(_fileno(file), long(boundary)) != 0) perror("result store");
+}
+
+void result_store_t::append(const unsigned char* record)
+{
+	drop_torn_record();
+	fseek(file, 0, SEEK_END);
+	fwrite(record, 1, record_size, file);
+	fflush(file);
+}
+
+#endif
+
+// Open or create
+result_store_t* open_result_store(const char* filename)
+{
+	unsigned char header[header_size];
+	memset(header, 0, sizeof(header));
+	memcpy(header, magic, sizeof(magic));
+	result_store_t* store = new result_store_t;
+	store->scanned = 0;
+#ifndef WIN32
+	// The header is written to a file of our own and then linked into place, so that nobody can open the
+	// store before it's there; if the store already exists the link fails and ours is thrown away
+	std::string temp = std::string(filename) + ".XXXXXX";
+	int fd = mkstemp(&temp[0]);
+	if (fd >= 0) {
+		const bool written = write(fd, header, header_size) == ssize_t(header_size);
+		close(fd);
+		if (!written) perror("result store");
+		else if (link(temp.c_str(), filename) == 0) chmod(filename, 0644);
+		unlink(temp.c_str());
+	}
+	store->fd = open(filename, O_RDWR | O_APPEND);
+	if (store->fd < 0) { delete store; return 0; }
+#else
+	store->file = fopen(filename, "r+b");
+	if (!store->file) {
+		store->file = fopen(filename, "w+b");
+		if (store->file) fwrite(header, 1, header_size, store->file);
+	}
+	if (!store->file) { delete store; return 0; }
+#endif
+	if (!store->refresh()) {
+		close_result_store(store);
+		return 0;
+	}
+	return store;
+}
+
+void close_result_store(result_store_t* store)
+{
+#ifndef WIN32
+	close(store->fd);
+#else
+	fclose(store->file);
+#endif
+	delete store;
+}
+
+// Look up a deal, in whichever rotation it was stored
+int lookup_result(result_store_t* store, const deal_t* deal, deal_analysis_t* analysis)
+{
+	if (!complete_deal(deal)) return 0;
+	deal_key_t key;
+	const int turn = canonical(deal, key);
+	std::lock_guard<std::mutex> lock(store->mutex);
+	std::map<deal_key_t, table_t>::const_iterator found = store->known.find(key);
+	if (found == store->known.end()) {
+		store->refresh();
+		found = store->known.find(key);
+		if (found == store->known.end()) return 0;
+	}
+	unpack_table(found->second, turn, analysis);
+	return 1;
+}
+
+// Add a deal
+void store_result(result_store_t* store, const deal_t* deal, const deal_analysis_t* analysis)
+{
+	if (!complete_deal(deal)) return;
+	deal_key_t key;
+	table_t table;
+	const int turn = canonical(deal, key);
+	pack_table(analysis, turn, table);
+	std::lock_guard<std::mutex> lock(store->mutex);
+	if (!store->known.insert(std::make_pair(key, table)).second) return;
+	unsigned char record[record_size];
+	memset(record, 0, sizeof(record));
+	memcpy(record, key.bytes, sizeof(key.bytes));
+	memcpy(record + table_offset, table.tricks, sizeof(table.tricks));
+	record[record_size-1] = complete;
+	store->append(record);
+}
+
+unsigned long result_store_size(result_store_t* store)
+{
+	std::lock_guard<std::mutex> lock(store->mutex);
+	return (unsigned long)store->known.size();
+}
@@ -0,0 +1,40 @@
+// This file is part of FreeFinesse, a double-dummy analyzer (c) Edward Lockhart, 2010
+// It is made available under the GPL; see the file COPYING for details
+
+//
+//  A file of double-dummy tables that have already been worked out, so that deals seen before (at
+//  another table, in another import, or with the hands rotated round the table) needn't be solved again
+//
+
+#pragma once
+
+#include "types.h"
+#include "par.h"
+
+// The store. Deals are looked up by their hands, whichever seat each is in; the table comes back
+// the right way round for the deal asked about. Records are only ever appended to the file, and a
+// reader takes each one once it's all there, so any number of processes can read it while others add to it.
+// A record left unfinished, by a process that died writing it, is cut off by the next one to add a record.
+struct result_store_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Opens the store, creating it if it doesn't exist. Returns null if it can't be opened or isn't a store.
+struct result_store_t* open_result_store(const char* filename);
+void close_result_store(struct result_store_t*);
+
+// Looks up the table for a complete deal. Returns 1 if it's known, 0 if not. Picks up anything other
+// processes have added since the last look. Can be called from any number of threads.
+int lookup_result(struct result_store_t*, const deal_t*, deal_analysis_t*);
+
+// Adds the table for a complete deal, unless it's already known
+void store_result(struct result_store_t*, const deal_t*, const deal_analysis_t*);
+
+// The number of distinct deals known
+unsigned long result_store_size(struct result_store_t*);
+
+#ifdef __cplusplus
+}
+#endif
@@ -71,19 +71,20 @@ void serialise_deal(const deal_t* deal, char* buff)
 {
 	char *p = buff;
 	for (int pl = 0; pl < 4; ++pl) {
-		for (int s = 0; s < 3; ++s) {
-			if (s > 0) *(p++) = '.';
-			for (int r = 0; r < 13; ++r) {
+		if (pl > 0) *(p++) = ' ';
+		for (int s = sx; s >= cx; --s) {
+			if (s < sx) *(p++) = '.';
+			for (int r = 12; r >= 0; --r) {
 				card_t c = card(suit_t(s), rank_t(r));
 				if (deal->holder[c] == pl) {
-					*(p++) = ranktext(c);
+					*(p++) = cranktext(c);
 				}
 			}
 		}
-		*(p++) = ' ';
 	}
-	*(p++) = suittext(deal->trumps);
+	*(p++) = ':';
 	*(p++) = playertext(deal->declarer);
+	*(p++) = suittext(deal->trumps);
 	*p = 0;
 }
 